@@ -13,6 +13,8 @@
 #include "log.h"
 #include "utils.h"
 #include "coroutine.h"
+#include "page.h"
+#include "servlet.h"
 
 GX_NS_BEGIN
 
@@ -36,6 +38,15 @@ Application::Application() noexcept
 , _script(_filemonitor)
 #endif
 , _type()
+, _loops(1)
+, _co_limit()
+, _co_idle()
+, _co_budget()
+, _page_trim(PageAllocator::default_trim_interval)
+, _page_idle()
+, _page_stats()
+, _flush_bytes()
+, _flush_delay()
 { }
 
 Application::~Application() noexcept {
@@ -61,6 +72,7 @@ bool Application::init_env(int argc, char* const argv[], const char *optstring,
         {"home",    required_argument, 0,  0 },
         {"node",    required_argument, 0,  0 },
         {"daemon",  no_argument,       0,  0 },
+        {"loops",   required_argument, 0,  0 },
         {0,         0,                 0,  0 }
     };
 
@@ -77,6 +89,9 @@ bool Application::init_env(int argc, char* const argv[], const char *optstring,
             case 2:
                 _daemon = true;
                 break;
+            case 3:
+                loops(strtoul(optarg, nullptr, 10));
+                break;
             }
             break;
         default:
@@ -136,6 +151,19 @@ bool Application::init(int argc, char* const argv[], const char *name, int type)
     if (!_network->init(_script, _timermgr, _reactor)) {
         log_error("init network failed.");
     }
+    _co_limit = _script->read_integer("coroutine_limit");
+    _co_idle = _script->read_integer("coroutine_idle_timeout");
+    _co_budget = _script->read_integer("coroutine_budget");
+    _page_trim = _script->read_integer("page_trim_interval", PageAllocator::default_trim_interval);
+    _page_idle = _script->read_integer("page_idle_timeout");
+    _page_stats = _script->read_integer("page_stats_interval");
+    _flush_bytes = _script->read_integer("reactor_flush_bytes");
+    _flush_delay = _script->read_integer("reactor_flush_delay");
+    Context::pool_cache(_script->read_integer("context_pool_cache", Context::default_pool_cache));
+    Context::pool_size(_script->read_integer("context_pool_size", PageAllocator::page_min_size));
+    PageAllocator::huge_pages((unsigned)_script->read_integer("page_huge_pages", PageAllocator::huge_none));
+    size_t queue_limit = _script->read_integer("servlet_queue_limit", ServletManager::default_queue_limit);
+    ServletManager::instance()->queue_limit(queue_limit);
 #endif
 
     if (type < 0 || (unsigned)type >= _network->nodes().size()) {
@@ -184,9 +212,16 @@ void Application::init_name(const char *name) noexcept {
 
 bool Application::loop() noexcept {
     timeval_t t = _timermgr->loop();
+    if (Coroutine::runnable()) {
+        t = 0;
+    }
     if (_reactor->loop(t) < 0) {
         return false;
     }
+    /* coroutines woken by timers and I/O run after the whole batch */
+    Coroutine::run();
+    /* pages this loop freed for other threads go back to them */
+    PageAllocator::flush();
     return true;
 }
 
@@ -213,13 +248,29 @@ void Application::run() noexcept {
         daemon();
     }
 
+    _network->reuse_port(_loops > 1);
     _network->startup(_type, _id);
     adjust_time();
-    srand((unsigned)gettimeofday());
+    srand((unsigned)walltime());
     Coroutine::init();
+    init_coroutines(_timermgr);
+    init_pages(_timermgr);
+    init_flush(_reactor);
+    for (unsigned i = 1; i < _loops; ++i) {
+        object<EventLoop> loop(i);
+        if (!loop->start(_type, _id)) {
+            log_error("start event loop %u failed.", i);
+            continue;
+        }
+        _event_loops.push_back(loop);
+    }
     while (__running) {
         loop();
     }
+    for (auto &loop : _event_loops) {
+        loop->join();
+    }
+    _event_loops.clear();
 
     _timermgr->clear();
     _network->shutdown_servlets();
@@ -235,6 +286,53 @@ void Application::run() noexcept {
     }
 }
 
+void Application::init_coroutines(TimerManager *tm) noexcept {
+    Coroutine::limit(_co_limit);
+    Coroutine::budget(_co_budget);
+    if (_co_idle) {
+        Coroutine::idle_timeout(_co_idle);
+    }
+    tm->schedule(1000, coroutine_timer);
+}
+
+timeval_t Application::coroutine_timer(Timer&, timeval_t) noexcept {
+    size_t n = Coroutine::shrink();
+    if (n) {
+        log_debug("%zu idle coroutines released, %zu left.", n, Coroutine::count());
+    }
+    ServletManager::instance()->resume_pending();
+    return 1000;
+}
+
+void Application::init_pages(TimerManager *tm) noexcept {
+    PageAllocator *pa = PageAllocator::instance();
+    if (_page_idle) {
+        pa->idle_timeout(_page_idle);
+    }
+    if (_page_trim) {
+        timeval_t interval = _page_trim;
+        tm->schedule(interval, [pa, interval](Timer&, timeval_t) {
+            size_t n = pa->trim();
+            if (n) {
+                log_debug("%zu bytes of free pages trimmed.", n);
+            }
+            return interval;
+        });
+    }
+    if (_page_stats) {
+        timeval_t interval = _page_stats;
+        tm->schedule(interval, [pa, interval](Timer&, timeval_t) {
+            pa->dump();
+            return interval;
+        });
+    }
+}
+
+void Application::init_flush(Reactor *reactor) noexcept {
+    reactor->flush_bytes(_flush_bytes);
+    reactor->flush_delay(_flush_delay);
+}
+
 timeval_t Application::file_monitor_timer(timeval_t r, Timer&, timeval_t) noexcept {
     _filemonitor->loop();
     return r;
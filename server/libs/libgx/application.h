@@ -3,6 +3,7 @@
 
 #include <string>
 #include <cstring>
+#include <vector>
 #include "platform.h"
 #include "memory.h"
 #include "timermanager.h"
@@ -12,6 +13,7 @@
 #include "network.h"
 #include "reactor.h"
 #include "filemonitor.h"
+#include "eventloop.h"
 
 GX_NS_BEGIN
 
@@ -30,9 +32,17 @@ public:
         return _type;
     }
     ptr<TimerManager> timer_manager() const noexcept {
+        EventLoop *loop = EventLoop::current();
+        if (loop) {
+            return loop->timer_manager();
+        }
         return _timermgr;
     }
     ptr<Reactor> reactor() const noexcept {
+        EventLoop *loop = EventLoop::current();
+        if (loop) {
+            return loop->reactor();
+        }
         return _reactor;
     }
     const char *name() const noexcept {
@@ -74,11 +84,31 @@ public:
         return _log_addr;
     }
     ptr<Network> network() const noexcept {
+        EventLoop *loop = EventLoop::current();
+        if (loop) {
+            return loop->network();
+        }
         return _network;
     }
+    unsigned loops() const noexcept {
+        return _loops;
+    }
+    void loops(unsigned value) noexcept {
+        _loops = value ? value : 1;
+    }
     bool is_daemon() const noexcept {
         return _daemon;
     }
+    /* applies the pool settings to the coroutines of the calling loop
+     * and schedules their maintenance on tm.
+     */
+    void init_coroutines(TimerManager *tm) noexcept;
+    /* the same for the trimming and the statistics dump of the calling
+     * loop's page allocator.
+     */
+    void init_pages(TimerManager *tm) noexcept;
+    /* the output flush policy of the calling loop's reactor */
+    void init_flush(Reactor *reactor) noexcept;
     bool loop() noexcept;
     void run() noexcept;
     void term() noexcept;
@@ -87,6 +117,7 @@ public:
 private:
     void init_name(const char *name) noexcept;
     timeval_t file_monitor_timer(timeval_t r, Timer&, timeval_t) noexcept;
+    static timeval_t coroutine_timer(Timer&, timeval_t) noexcept;
     static void shutdown_routine(void *param) noexcept;
 private:
     unsigned _id;
@@ -110,6 +141,16 @@ private:
     object<Network> _network;
     Address _log_addr;
     int _type;
+    unsigned _loops;
+    std::vector<ptr<EventLoop>> _event_loops;
+    size_t _co_limit;
+    timeval_t _co_idle;
+    size_t _co_budget;
+    timeval_t _page_trim;
+    timeval_t _page_idle;
+    timeval_t _page_stats;
+    size_t _flush_bytes;
+    timeval_t _flush_delay;
 public:
     std::function<void()> shutdown;
 };
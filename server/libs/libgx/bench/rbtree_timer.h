@@ -0,0 +1,143 @@
+#ifndef __GX_BENCH_RBTREE_TIMER_H__
+#define __GX_BENCH_RBTREE_TIMER_H__
+
+/* The rbtree TimerManager the wheel replaced, kept only for timer_bench
+ * to measure against. Same interface, singleton and weak refs dropped.
+ */
+#include <functional>
+#include "memory.h"
+#include "rbtree.h"
+#include "timeval.h"
+#include "obstack.h"
+#include "allocator.h"
+
+GX_NS_BEGIN
+
+class RbTimerManager;
+
+class RbTimer : protected rbtree::node {
+    friend class RbTimerManager;
+public:
+    typedef std::function<timeval_t(RbTimer&, timeval_t)> handler_type;
+
+    void close() noexcept;
+    timeval_t expire() const noexcept {
+        return _expires;
+    }
+private:
+    timeval_t _expires;
+    handler_type _handler;
+    RbTimerManager *_mgr;
+};
+
+class RbTimerManager : public Object, protected rbtree {
+public:
+    RbTimerManager() noexcept : _left(), _cache(_pool) { }
+    ~RbTimerManager() {
+        clear();
+    }
+
+    RbTimer *schedule_abs(timeval_t expires, RbTimer::handler_type handler) noexcept {
+        RbTimer *timer = _cache.construct();
+        timer->_expires = expires;
+        timer->_handler = std::move(handler);
+        timer->_mgr = this;
+        schedule_timer(timer);
+        return timer;
+    }
+    void remove(RbTimer *timer) noexcept {
+        if (timer->_mgr == this) {
+            remove_timer(timer);
+            _cache.destroy(timer);
+        }
+    }
+    timeval_t loop(timeval_t curtime) noexcept;
+    void clear() noexcept;
+private:
+    void schedule_timer(RbTimer *timer) noexcept;
+    void remove_timer(RbTimer *timer) noexcept {
+        if (_left == timer) {
+            _left = static_cast<RbTimer*>(timer->next());
+        }
+        rbtree::remove(timer);
+    }
+private:
+    RbTimer *_left;
+    object<Obstack> _pool;
+    object_cache<RbTimer, Obstack> _cache;
+};
+
+inline void RbTimer::close() noexcept {
+    if (_mgr) {
+        _mgr->remove(this);
+    }
+}
+
+inline void RbTimerManager::schedule_timer(RbTimer *new_timer) noexcept {
+    node **link = &_root;
+    node *parent = nullptr;
+    int left = 1;
+
+    while (*link) {
+        parent = *link;
+        RbTimer *timer = static_cast<RbTimer*>(parent);
+        if (new_timer->_expires < timer->_expires) {
+            link = &(*link)->_left;
+        } else {
+            link = &(*link)->_right;
+            left = 0;
+        }
+    }
+
+    if (left) {
+        _left = new_timer;
+    }
+    rbtree::link(new_timer, parent, link);
+    rbtree::insert(new_timer);
+}
+
+inline timeval_t RbTimerManager::loop(timeval_t curtime) noexcept {
+    RbTimer *timer;
+again:
+    while ((timer = _left)) {
+        if (curtime < timer->_expires) {
+            return timer->_expires;
+        }
+
+        while (1) {
+            timer->_mgr = nullptr;
+            timeval_t d = timer->_handler(*timer, curtime);
+            if (!d) {
+                remove_timer(timer);
+                _cache.destroy(timer);
+                goto again;
+            }
+            d += timer->_expires;
+            if (d > curtime) {
+                timer->_mgr = this;
+                remove_timer(timer);
+                timer->_expires = d;
+                schedule_timer(timer);
+                goto again;
+            }
+            timer->_expires = d;
+        }
+    }
+    return (timeval_t)-1;
+}
+
+inline void RbTimerManager::clear() noexcept {
+    RbTimer *timer = _left;
+    RbTimer *tmp;
+    while (timer) {
+        tmp = static_cast<RbTimer*>(timer->next());
+        _cache.destroy(timer);
+        timer = tmp;
+    }
+    _left = nullptr;
+    rbtree::clear();
+}
+
+GX_NS_END
+
+#endif
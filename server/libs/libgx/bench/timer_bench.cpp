@@ -0,0 +1,73 @@
+/* TimerManager cost per timer: schedule, cancel and expire of `count`
+ * timers spread over `range` ms, half cancelled, the wheel driven one ms
+ * at a time. Then the cost of a loop() tick with a few sparse timers,
+ * what an idle server pays. Both run for the wheel and for the rbtree
+ * manager it replaced (bench/rbtree_timer.h).
+ *
+ *     make bench/timer_bench && bench/timer_bench [count [range]]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include "timermanager.h"
+#include "rbtree_timer.h"
+
+GX_NS_USING
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double nsec(bench_clock::duration d, size_t n) {
+    return std::chrono::duration<double, std::nano>(d).count() / n;
+}
+
+template <typename _Timer>
+static timeval_t done(_Timer&, timeval_t) {
+    return 0;
+}
+
+template <typename _Manager, typename _Timer>
+static void run(const char *name, size_t count, timeval_t range) {
+    _Manager *mgr = new _Manager;
+    std::vector<_Timer*> timers(count);
+    timeval_t cur = monotime();
+
+    srand(7);
+    mgr->loop(cur);
+    auto t0 = bench_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        timers[i] = mgr->schedule_abs(cur + 1 + rand() % range, done<_Timer>);
+    }
+    auto t1 = bench_clock::now();
+    for (size_t i = 0; i < count; i += 2) {
+        timers[i]->close();
+    }
+    auto t2 = bench_clock::now();
+    for (timeval_t t = cur; t <= cur + range + 1; ++t) {
+        mgr->loop(t);
+    }
+    auto t3 = bench_clock::now();
+    printf("[%s] schedule %.0f ns, cancel %.0f ns, expire %.0f ns per timer\n", name,
+        nsec(t1 - t0, count), nsec(t2 - t1, (count + 1) / 2), nsec(t3 - t2, count / 2));
+
+    cur += range + 2;
+    for (size_t i = 0; i < 16; ++i) {
+        mgr->schedule_abs(cur + 1 + rand() % range, done<_Timer>);
+    }
+    t0 = bench_clock::now();
+    for (timeval_t t = cur; t <= cur + range + 1; ++t) {
+        mgr->loop(t);
+    }
+    t1 = bench_clock::now();
+    printf("[%s] idle loop %.0f ns per tick\n", name, nsec(t1 - t0, range + 2));
+    delete mgr;
+}
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    timeval_t range = argc > 2 ? strtoul(argv[2], nullptr, 10) : 30000;
+
+    run<TimerManager, Timer>("wheel", count, range);
+    run<RbTimerManager, RbTimer>("rbtree", count, range);
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include "log.h"
 #include "application.h"
 
+#include <vector>
+
 GX_NS_BEGIN
 
 bool ContextBase::running() const noexcept {
@@ -14,13 +16,23 @@ std::function<ptr<Context>()> Context::factory = []() {
     return object<Context>();
 };
 
+size_t Context::_pool_cache = Context::default_pool_cache;
+size_t Context::_pool_size = PageAllocator::page_min_size;
+static thread_local std::vector<ptr<Obstack>> __pools;
+
 Context::Context() noexcept
 : _trans(),
   _network(),
   _servlet(),
   _seq(),
   _size(),
-  _call_result()
+  _call_result(),
+  _call_wait(),
+  _call(),
+  _input(),
+  _wake(),
+  _wake_arg(),
+  _woken()
 { }
 
 Context::~Context() noexcept {
@@ -58,23 +70,77 @@ void Context::finish() noexcept {
     _servlet = nullptr;
     _seq = 0;
     _size = 0;
-    _pool = nullptr;
+    _call = nullptr;
+    _input = nullptr;
+    _wake = nullptr;
+    _wake_arg = nullptr;
+    if (_pool) {
+        free_pool();
+    }
     clear();
 }
 
+ptr<Obstack> Context::alloc_pool() noexcept {
+    if (__pools.empty()) {
+        return object<Obstack>(_pool_size);
+    }
+    ptr<Obstack> pool = std::move(__pools.back());
+    __pools.pop_back();
+    return pool;
+}
+
+void Context::free_pool() noexcept {
+    /* a response or a message may still point into it */
+    if (_pool->use_count() == 1 && __pools.size() < _pool_cache) {
+        _pool->clear();
+        __pools.push_back(std::move(_pool));
+    }
+    _pool = nullptr;
+}
+
+void Context::release_pools() noexcept {
+    __pools.clear();
+}
+
+void Context::wake() noexcept {
+    if (!_wake) {
+        co()->schedule();
+    }
+    else if (!_woken) {
+        /* one wake-up in flight at a time, as schedule() does for coroutines */
+        _woken = true;
+        Coroutine::post(wake_routine, this);
+    }
+}
+
+void Context::wake_routine(void *param) noexcept {
+    Context *ctx = static_cast<Context*>(param);
+    ctx->_woken = false;
+    if (ctx->_wake) {
+        ctx->_wake(ctx->_wake_arg);
+    }
+}
+
 void Context::call_ok() noexcept {
     _call_result = GX_CALL_OK;
-    co()->resume();
+    wake();
 }
 
 void Context::call_cancel() noexcept {
     _call_result = GX_CALL_CANCEL;
-    co()->resume();
+    wake();
 }
 
 void Context::call_timedout() noexcept {
     _call_result = GX_CALL_TIMEDOUT;
-    co()->resume();
+    wake();
+}
+
+/* one call of a fan-out finished, resume once enough have */
+void Context::call_done() noexcept {
+    if (_call_wait && !--_call_wait) {
+        call_ok();
+    }
 }
 
 void Context::call_yield() {
@@ -102,7 +168,7 @@ void Context::sleep(timeval_t time) noexcept {
         return;
     }
     the_app->timer_manager()->schedule(time, [this](Timer&, timeval_t){
-        co()->resume();
+        wake();
         return 0;
     });
     Coroutine::yield();
@@ -16,6 +16,11 @@ class Coroutine;
 class ServletBase;
 class Peer;
 class Network;
+class NetworkInstance;
+class Context;
+struct INotify;
+struct IRequest;
+struct IResponse;
 
 enum {
     GX_CALL_OK,
@@ -24,6 +29,33 @@ enum {
     GX_CALL_UNKNOWN,
 };
 
+/* Call
+ * One outstanding request of Network::call or a Network::call_all fan-out. result becomes GX_CALL_OK once
+ * the response has been read into rsp, GX_CALL_TIMEDOUT or GX_CALL_CANCEL on
+ * failure, and stays GX_CALL_UNKNOWN for calls still in flight when the
+ * caller resumed early.
+ */
+struct Call {
+    Call() noexcept
+    : id(), servlet(), req(), rsp(), instance(), result(GX_CALL_UNKNOWN), seq(), ctx()
+    { }
+    Call(uint64_t id, unsigned servlet, INotify *req, IResponse *rsp, NetworkInstance *instance = nullptr) noexcept
+    : id(id), servlet(servlet), req(req), rsp(rsp), instance(instance), result(GX_CALL_UNKNOWN), seq(), ctx()
+    { }
+    template <typename _Message>
+    Call(_Message &msg, NetworkInstance *instance = nullptr) noexcept;
+
+    uint64_t id;
+    unsigned servlet;
+    INotify *req;
+    IResponse *rsp;
+    NetworkInstance *instance;
+    int result;
+    unsigned seq;
+    Context *ctx;
+    list_entry _entry;
+};
+
 class ContextBase : public Object {
     friend class CoManager;
 public:
@@ -58,10 +90,32 @@ public:
     }
     Obstack *pool() noexcept {
         if (!_pool) {
-            _pool = object<Obstack>();
+            _pool = alloc_pool();
         }
         return _pool;
     }
+
+    /* Pool recycling
+     * pool() takes a cleared Obstack from a per-thread cache, finish() puts
+     * it back unless someone else still holds it. pool_cache bounds the
+     * cache, pool_size is the first chunk of a new pool and all that a
+     * cached one keeps. release_pools() empties the calling thread's cache,
+     * before its PageAllocator goes.
+     */
+    static constexpr const size_t default_pool_cache = 64;
+    static void pool_cache(size_t value) noexcept {
+        _pool_cache = value;
+    }
+    static size_t pool_cache() noexcept {
+        return _pool_cache;
+    }
+    static void pool_size(size_t value) noexcept {
+        _pool_size = value;
+    }
+    static size_t pool_size() noexcept {
+        return _pool_size;
+    }
+    static void release_pools() noexcept;
     virtual bool begin(Network *network, Peer *peer) noexcept;
     virtual bool commit() noexcept;
     virtual void rollback(bool fail) noexcept;
@@ -80,6 +134,7 @@ public:
     void call_cancel() noexcept;
     void call_timedout() noexcept;
     void call_yield();
+    void call_done() noexcept;
     int call_result() const noexcept {
         return _call_result;
     }
@@ -87,6 +142,15 @@ public:
         _call_result = result;
     }
     void sleep(timeval_t time) noexcept;
+
+    /* Wakes whoever waits on this context through the run queue, its
+     * coroutine unless wake_with() routed wake-ups to fn(arg) instead.
+     */
+    void wake() noexcept;
+    void wake_with(void (*fn)(void*), void *arg) noexcept {
+        _wake = fn;
+        _wake_arg = arg;
+    }
     void *trans() noexcept {
         return _trans;
     }
@@ -94,7 +158,10 @@ protected:
     virtual void clear() noexcept;
     void *_trans;
 private:
-    list_entry _entry;
+    static void wake_routine(void *param) noexcept;
+    static ptr<Obstack> alloc_pool() noexcept;
+    void free_pool() noexcept;
+private:
     Network *_network;
     weak_ptr<Peer> _peer;
     ServletBase *_servlet;
@@ -102,7 +169,15 @@ private:
     size_t _size;
     weak_ptr<Timer> _timer;
     int _call_result;
+    unsigned _call_wait;
+    Call *_call;
+    Stream *_input;
+    void (*_wake)(void*);
+    void *_wake_arg;
+    bool _woken;
     ptr<Obstack> _pool;
+    static size_t _pool_cache;
+    static size_t _pool_size;
 };
 
 
@@ -113,6 +188,16 @@ inline Obstack *the_pool() noexcept {
     return the_context()->pool();
 }
 
+template <typename _Message>
+inline Call::Call(_Message &msg, NetworkInstance *instance) noexcept
+: id(msg.req->id()), servlet(_Message::the_message_id), req(msg.req), rsp(), instance(instance),
+  result(GX_CALL_UNKNOWN), seq(), ctx()
+{
+    Obstack *pool = the_pool();
+    msg.rsp = pool->construct<typename _Message::response_type>(pool);
+    rsp = msg.rsp;
+}
+
 GX_NS_END
 
 #endif
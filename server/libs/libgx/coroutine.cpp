@@ -1,25 +1,204 @@
 #include "coroutine.h"
 #include "log.h"
 #include "context.h"
+#include <cstring>
 
-#define GX_CO_CAP       4096
-#define GX_CO_MEMSIZE   (64 * 1024)
+#ifndef GX_PLATFORM_WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* virtual size of a coroutine per stack class: a guard page, the stack,
+ * then the Coroutine itself at the top. Pages are only committed once
+ * touched.
+ */
+#define GX_CO_MEMSIZE_SMALL     (64 * 1024)
+#define GX_CO_MEMSIZE_MEDIUM    (256 * 1024)
+#define GX_CO_MEMSIZE_LARGE     (1024 * 1024)
 #define GX_CO_GROW      32
+#define GX_CO_IDLE      (60 * 1000)
+#define GX_CO_PAINT     0ull    /* what fresh stack pages read */
+#define GX_CO_SLACK     1024    /* left alone below the running frame by repaint() */
 #define GX_CO_CTXSIZE   gx_align_default(sizeof(coctx_t))
-#define GX_CO_STKSIZE   (GX_CO_MEMSIZE - gx::offsetof_member(&Coroutine::_placeholder) - sizeof(long) - GX_CO_CTXSIZE)
+#define GX_CO_HEADSIZE  gx_align(gx::offsetof_member(&Coroutine::_placeholder) + GX_CO_CTXSIZE, 16)
+
+#ifdef GX_CO_USE_ASM
+/* gx_coctx_swap(void **osp, void *nsp)
+ * Saves the callee-saved registers on the current stack, stores the stack
+ * pointer in *osp, then loads nsp and pops what was saved there. Unlike
+ * swapcontext it leaves the signal mask alone, so no system call is made.
+ */
+extern "C" void gx_coctx_swap(void **osp, void *nsp) noexcept;
+
+#if defined(__x86_64__)
+/* six registers, the return address and func's own fake return address */
+#define GX_CO_FRAME     64
+#define GX_CO_FRAME_PC  6
+asm(R"(
+    .text
+    .globl gx_coctx_swap
+    .type gx_coctx_swap, @function
+    .p2align 4
+gx_coctx_swap:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size gx_coctx_swap, .-gx_coctx_swap
+)");
+#elif defined(__aarch64__)
+/* x19-x30 and d8-d15, x30 being the return address */
+#define GX_CO_FRAME     160
+#define GX_CO_FRAME_PC  11
+asm(R"(
+    .text
+    .globl gx_coctx_swap
+    .type gx_coctx_swap, %function
+    .p2align 4
+gx_coctx_swap:
+    sub sp, sp, #160
+    stp x19, x20, [sp, #0]
+    stp x21, x22, [sp, #16]
+    stp x23, x24, [sp, #32]
+    stp x25, x26, [sp, #48]
+    stp x27, x28, [sp, #64]
+    stp x29, x30, [sp, #80]
+    stp d8, d9, [sp, #96]
+    stp d10, d11, [sp, #112]
+    stp d12, d13, [sp, #128]
+    stp d14, d15, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp x19, x20, [sp, #0]
+    ldp x21, x22, [sp, #16]
+    ldp x23, x24, [sp, #32]
+    ldp x25, x26, [sp, #48]
+    ldp x27, x28, [sp, #64]
+    ldp x29, x30, [sp, #80]
+    ldp d8, d9, [sp, #96]
+    ldp d10, d11, [sp, #112]
+    ldp d12, d13, [sp, #128]
+    ldp d14, d15, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size gx_coctx_swap, .-gx_coctx_swap
+)");
+#endif
+#endif
 
 GX_NS_BEGIN
 
 
 static object<CoManager> __mgr;
-CoManager *Coroutine::_mgr = __mgr;
+thread_local CoManager *Coroutine::_mgr = __mgr;
+
+static size_t __co_guard_size() noexcept {
+#ifdef GX_PLATFORM_WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+#else
+    return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+static const size_t __co_memsize[Coroutine::STACK_CLASSES] = {
+    GX_CO_MEMSIZE_SMALL,
+    GX_CO_MEMSIZE_MEDIUM,
+    GX_CO_MEMSIZE_LARGE,
+};
+
+static char *__co_map(size_t size) noexcept {
+    static size_t guard = __co_guard_size();
+#ifdef GX_PLATFORM_WIN32
+    char *base = (char*)VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    DWORD old;
+    if (base && !VirtualProtect(base, guard, PAGE_NOACCESS, &old)) {
+        VirtualFree(base, 0, MEM_RELEASE);
+        return nullptr;
+    }
+    return base;
+#else
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    if (mprotect(base, guard, PROT_NONE)) {
+        munmap(base, size);
+        return nullptr;
+    }
+    return (char*)base;
+#endif
+}
+
+static void __co_unmap(char *base, size_t size) noexcept {
+#ifdef GX_PLATFORM_WIN32
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, size);
+#endif
+}
+
+size_t Coroutine::stack_class_size(unsigned stack_class) noexcept {
+    assert(stack_class < STACK_CLASSES);
+    return __co_memsize[stack_class];
+}
+
+/* how far down the stack has been written since it was painted */
+static size_t __co_used(const char *stack, size_t size) noexcept {
+    const uint64_t *p = (const uint64_t*)stack;
+    const uint64_t *end = (const uint64_t*)(stack + size);
+    while (p < end && *p == GX_CO_PAINT) {
+        ++p;
+    }
+    return (const char*)end - (const char*)p;
+}
+
+size_t Coroutine::stack_used() const noexcept {
+    if (!_painted) {
+        return 0;
+    }
+    return __co_used(_stack, _stack_size);
+}
 
-CoManager::CoManager() noexcept {
-    size_t n = sizeof(Coroutine*) * GX_CO_CAP;
-    _coroutines = (Coroutine**)::malloc(n);
-    memset(_coroutines, 0, n);
-    _size = 0;
+void Coroutine::repaint() noexcept {
+    assert(this == _mgr->_busy_list.front());
+    if (!_painted) {
+        return;
+    }
+    char here;
+    char *top = &here - GX_CO_SLACK;
+    char *low = _stack + _stack_size - __co_used(_stack, _stack_size);
+    if (low < top) {
+        memset(low, 0, top - low);
+    }
+}
+
+CoManager::CoManager() noexcept
+: _ready_count(),
+  _budget(),
+  _profile(::getenv("GX_CO_PROFILE") != nullptr),
+  _limit(),
+  _idle_timeout(GX_CO_IDLE)
+{
     _busy_list.push_front(&_main);
+    _main._stack = nullptr;
+    _main._stack_size = 0;
+    _main._stack_class = Coroutine::STACK_MEDIUM;
+    _main._painted = false;
+    _main._scheduled = false;
     _main._status = Coroutine::DEAD;
     _main._ctx = &_mainctx;
 
@@ -31,15 +210,12 @@ CoManager::CoManager() noexcept {
 }
 
 CoManager::~CoManager() noexcept {
-    for (unsigned i = 0; i < GX_CO_CAP; ++i) {
-        Coroutine *co = _coroutines[i];
-        if (co) {
-            Page *page = co->_page;
-            co->~Coroutine();
-            PageAllocator::instance()->free(page);
-        }
+    for (Coroutine *co : _coroutines) {
+        char *base = co->_base;
+        size_t size = __co_memsize[co->_stack_class];
+        co->~Coroutine();
+        __co_unmap(base, size);
     }
-    ::free(_coroutines);
 }
 
 void CoManager::init() noexcept {
@@ -47,46 +223,106 @@ void CoManager::init() noexcept {
     _main._context->_co = &_main;
 }
 
-bool CoManager::grow() noexcept {
-    if (_size + GX_CO_GROW > GX_CO_CAP) {
-        return false;
+bool CoManager::grow(unsigned stack_class) noexcept {
+    static size_t guard = __co_guard_size();
+    size_t size = __co_memsize[stack_class];
+    size_t n = GX_CO_GROW;
+    if (_limit) {
+        if (_coroutines.size() >= _limit) {
+            return false;
+        }
+        if (n > _limit - _coroutines.size()) {
+            n = _limit - _coroutines.size();
+        }
     }
-    unsigned i = _size;
-    _size += GX_CO_GROW;
-    for (; i < _size; i++) {
-        Page *page = PageAllocator::instance()->alloc(GX_CO_MEMSIZE);
-        Coroutine *co = new(page->firstp) Coroutine;
-        co->_page = page;
+    for (unsigned i = 0; i < n; i++) {
+        char *base = __co_map(size);
+        if (!base) {
+            return i > 0;
+        }
+        Coroutine *co = new(base + size - GX_CO_HEADSIZE) Coroutine;
+        co->_base = base;
         co->_status = Coroutine::DEAD;
         co->_ctx = (coctx_t*)co->_placeholder;
-        co->_stack = co->_placeholder + GX_CO_CTXSIZE;
-        _free_list.push_front(co);
-        _coroutines[i] = co;
+        co->_stack = base + guard;
+        co->_stack_size = (char*)co - co->_stack;
+        co->_stack_class = stack_class;
+        co->_painted = false;
+        co->_scheduled = false;
+        co->_index = _coroutines.size();
+        co->_idle_time = monotime();
+        _free_list[stack_class].push_front(co);
+        _coroutines.push_back(co);
     }
     return true;
 }
 
+void CoManager::destroy(Coroutine *co) noexcept {
+    Coroutine *last = _coroutines.back();
+    _coroutines[co->_index] = last;
+    last->_index = co->_index;
+    _coroutines.pop_back();
+
+    char *base = co->_base;
+    size_t size = __co_memsize[co->_stack_class];
+    co->~Coroutine();
+    __co_unmap(base, size);
+}
+
+size_t CoManager::shrink() noexcept {
+    if (!_idle_timeout) {
+        return 0;
+    }
+    timeval_t now = monotime();
+    size_t n = 0;
+    for (auto &list : _free_list) {
+        /* most recently freed first, everything past the first expired one is older */
+        Coroutine *co = list.front();
+        while (co && co->_idle_time + _idle_timeout > now) {
+            co = co_list_t::next(co);
+        }
+        while (co) {
+            Coroutine *next = co_list_t::next(co);
+            co_list_t::remove(co);
+            destroy(co);
+            co = next;
+            n++;
+        }
+    }
+    return n;
+}
+
 void CoManager::routine() noexcept {
-    CoManager *mgr = __mgr;
+    CoManager *mgr = Coroutine::_mgr;
 
     Coroutine *co = mgr->_busy_list.front();
     co->_routine(co->_ud);
     co->_status = Coroutine::DEAD;
     mgr->_busy_list.pop_front();
-    mgr->_free_list.push_front(co);
+    co->_idle_time = monotime();
+    mgr->_free_list[co->_stack_class].push_front(co);
     Coroutine *caller = mgr->_busy_list.front();
     assert(caller);
     Coroutine::switch_context(co->_ctx, caller->_ctx);
 }
 
-Coroutine *CoManager::spawn(Coroutine::routine_t routine, void *ud) noexcept {
+Coroutine *CoManager::spawn(Coroutine::routine_t routine, void *ud, unsigned stack_class) noexcept {
     Coroutine *co;
-    if (!(co = _free_list.pop_front())) {
-        if (!grow()) {
+    assert(stack_class < Coroutine::STACK_CLASSES);
+    if (!(co = _free_list[stack_class].pop_front())) {
+        if (!grow(stack_class)) {
             return nullptr;
         }
-        co = _free_list.pop_front();
+        co = _free_list[stack_class].pop_front();
+    }
+    if (_profile) {
+        /* the coroutine isn't running, paint what its last run wrote, the
+         * pages below were never touched and still read zero
+         */
+        size_t used = __co_used(co->_stack, co->_stack_size);
+        memset(co->_stack + co->_stack_size - used, 0, used);
     }
+    co->_painted = _profile;
     _yield_list.push_front(co);
     co->_routine = routine;
     co->_ud = ud;
@@ -105,9 +341,15 @@ bool CoManager::resume(Coroutine *co) noexcept {
         return false;
     }
 
+    if (co->_scheduled) {
+        ready_list_t::remove(co);
+        co->_scheduled = false;
+        _ready_count--;
+    }
+
     switch (co->_status) {
     case Coroutine::READY:
-        Coroutine::set_context(co->_ctx, routine, co->_stack, GX_CO_STKSIZE);
+        Coroutine::set_context(co->_ctx, routine, co->_stack, co->_stack_size);
     case Coroutine::SUSPEND:
         co_list_t::remove(co);
         _busy_list.push_front(co);
@@ -136,13 +378,62 @@ bool CoManager::yield() noexcept {
 	return true;
 }
 
-void Coroutine::init() noexcept {
+void CoManager::schedule(Coroutine *co) noexcept {
+    if (co->_scheduled || (co->_status != Coroutine::READY && co->_status != Coroutine::SUSPEND)) {
+        return;
+    }
+    co->_scheduled = true;
+    _ready_list.push_back(co);
+    _ready_count++;
+}
+
+void CoManager::post(void (*fn)(void*), void *arg) noexcept {
+    _posted.emplace_back(fn, arg);
+}
+
+size_t CoManager::run() noexcept {
+    assert(is_main_routine());
+    size_t n = 0;
+    if (!_posted.empty()) {
+        /* callbacks posted meanwhile wait for the next run */
+        size_t count = _posted.size();
+        for (size_t i = 0; i < count; ++i) {
+            std::pair<void(*)(void*), void*> it = _posted[i];
+            it.first(it.second);
+        }
+        _posted.erase(_posted.begin(), _posted.begin() + count);
+        n += count;
+    }
+    Coroutine *co;
+    while ((!_budget || n < _budget) && (co = _ready_list.pop_front())) {
+        co->_scheduled = false;
+        _ready_count--;
+        resume(co);
+        n++;
+    }
+    return n;
+}
+
+void Coroutine::init(CoManager *mgr) noexcept {
+    if (!mgr) {
+        mgr = __mgr;
+    }
+    _mgr = mgr;
     _mgr->init();
 }
 
 inline void Coroutine::set_context(coctx_t *ctx, void (*func)(), char *stkbase, long stksiz) noexcept {
 #ifdef GX_PLATFORM_WIN32
 	*ctx = CreateFiberEx(stksiz, stksiz, FIBER_FLAG_FLOAT_SWITCH, (LPFIBER_START_ROUTINE)func, 0);
+#elif defined(GX_CO_USE_ASM)
+    /* a frame gx_coctx_swap pops into zeroed registers and returns to func,
+     * leaving the stack aligned as if func had been called
+     */
+    uintptr_t top = ((uintptr_t)stkbase + stksiz - sizeof(long)) & ~(uintptr_t)15;
+    void **frame = (void**)(top - GX_CO_FRAME);
+    memset(frame, 0, GX_CO_FRAME);
+    frame[GX_CO_FRAME_PC] = (void*)func;
+    ctx->sp = frame;
 #else
     getcontext(ctx);
 
@@ -160,6 +451,8 @@ inline void Coroutine::switch_context(coctx_t *octx, coctx_t *nctx) noexcept {
 #ifdef GX_PLATFORM_WIN32
 	*octx = GetCurrentFiber();
 	SwitchToFiber(*nctx);
+#elif defined(GX_CO_USE_ASM)
+    gx_coctx_swap(&octx->sp, nctx->sp);
 #else
 	swapcontext(octx, nctx);
 #endif
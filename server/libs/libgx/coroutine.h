@@ -4,15 +4,23 @@
 #include "platform.h"
 #ifdef GX_PLATFORM_WIN32
 typedef LPVOID coctx_t;
+#elif (defined(__x86_64__) || defined(__aarch64__)) && !defined(GX_CO_USE_UCONTEXT)
+/* only the stack pointer, callee-saved registers are pushed on the stack */
+#define GX_CO_USE_ASM
+struct coctx_t {
+    void *sp;
+};
 #else
 #include <ucontext.h>
 //struct ucontext;
 typedef ucontext_t coctx_t;
 #endif
 
+#include <vector>
 #include "object.h"
 #include "list.h"
 #include "page.h"
+#include "timeval.h"
 
 GX_NS_BEGIN
 
@@ -31,14 +39,36 @@ public:
         SUSPEND,
     };
 
+    /* stack size classes, see stack_class_size() */
+    enum {
+        STACK_SMALL,
+        STACK_MEDIUM,
+        STACK_LARGE,
+        STACK_CLASSES,
+    };
+
 public:
-    static Coroutine *spawn(Coroutine::routine_t routine, void *ud) noexcept;
-    static void init() noexcept;
+    static Coroutine *spawn(Coroutine::routine_t routine, void *ud, unsigned stack_class = STACK_MEDIUM) noexcept;
+    static void init(CoManager *mgr = nullptr) noexcept;
     bool resume() noexcept;
     static bool yield() noexcept;
     static Coroutine *self() noexcept;
     static bool is_main_routine() noexcept;
 
+    /* Run queue
+     * schedule() marks a suspended coroutine runnable instead of switching
+     * to it from wherever the wake-up happened, run() resumes the runnable
+     * ones in order from the main routine, at most budget() of them per
+     * call (0 means until the queue is empty). post() queues a plain
+     * callback, for waiters that aren't coroutines of this manager.
+     */
+    void schedule() noexcept;
+    static void post(void (*fn)(void*), void *arg) noexcept;
+    static size_t run() noexcept;
+    static size_t runnable() noexcept;
+    static void budget(size_t value) noexcept;
+    static size_t budget() noexcept;
+
     int status() const noexcept {
         return _status;
     }
@@ -48,35 +78,80 @@ public:
     bool running() const noexcept {
         return _status == RUNNING;
     }
+    unsigned stack_class() const noexcept {
+        return _stack_class;
+    }
+    size_t stack_size() const noexcept {
+        return _stack_size;
+    }
+    static size_t stack_class_size(unsigned stack_class) noexcept;
+
+    /* Stack profiling
+     * While on (or GX_CO_PROFILE is set in the environment), stacks are
+     * painted when spawned and stack_used() finds the deepest nonzero word
+     * written since. The paint is zero, what untouched pages read, so only
+     * the part the previous run wrote gets painted and the rest of the
+     * stack stays uncommitted. repaint() paints again below the running
+     * frame of self(), for a coroutine that runs one job after another.
+     */
+    static void profile(bool value) noexcept;
+    static bool profile() noexcept;
+    size_t stack_used() const noexcept;
+    void repaint() noexcept;
+
+    /* Pool size
+     * spawn() fails once limit coroutines exist (0 means no limit).
+     * shrink() unmaps the ones left free for longer than idle_timeout,
+     * call it periodically.
+     */
+    static void limit(size_t value) noexcept;
+    static size_t limit() noexcept;
+    static size_t count() noexcept;
+    static void idle_timeout(timeval_t value) noexcept;
+    static timeval_t idle_timeout() noexcept;
+    static size_t shrink() noexcept;
 private:
     static void set_context(coctx_t *cc, void (*func)(), char *stkbase, long stksiz) noexcept;
     static void switch_context(coctx_t *octx, coctx_t *nctx) noexcept;
 
 private:
     list_entry _entry;
+    clist_entry _ready_entry;
+    bool _scheduled;
     int _status;
     ptr<Context> _context;
-    Page *_page;
+    char *_base;
     routine_t _routine;
     char *_stack;
+    size_t _stack_size;
+    unsigned _stack_class;
+    bool _painted;
+    size_t _index;
+    timeval_t _idle_time;
     void *_ud;
     coctx_t *_ctx;
     char _placeholder[1];
-    static CoManager *_mgr;
+    static thread_local CoManager *_mgr;
 };
 
 class CoManager : public Object {
     friend class Coroutine;
     typedef gx_list(Coroutine, _entry) co_list_t;
+    typedef gx_list(Coroutine, _ready_entry) ready_list_t;
 public:
     CoManager() noexcept;
     ~CoManager() noexcept;
 private:
-    bool grow() noexcept;
+    bool grow(unsigned stack_class) noexcept;
+    size_t shrink() noexcept;
+    void destroy(Coroutine *co) noexcept;
     static void routine() noexcept;
-    Coroutine *spawn(Coroutine::routine_t routine, void *ud) noexcept;
+    Coroutine *spawn(Coroutine::routine_t routine, void *ud, unsigned stack_class) noexcept;
     bool resume(Coroutine *co) noexcept;
     bool yield() noexcept;
+    void schedule(Coroutine *co) noexcept;
+    void post(void (*fn)(void*), void *arg) noexcept;
+    size_t run() noexcept;
     Coroutine *self() noexcept {
         Coroutine *co = _busy_list.front();
         assert(co);
@@ -87,17 +162,23 @@ private:
         return self() == &_main;
     }
 private:
-    Coroutine **_coroutines;
-    size_t _size;
+    std::vector<Coroutine*> _coroutines;
     Coroutine _main;
     coctx_t _mainctx;
-    co_list_t _free_list;
+    co_list_t _free_list[Coroutine::STACK_CLASSES];
     co_list_t _yield_list;
     co_list_t _busy_list;
+    ready_list_t _ready_list;
+    std::vector<std::pair<void(*)(void*), void*>> _posted;
+    size_t _ready_count;
+    size_t _budget;
+    bool _profile;
+    size_t _limit;
+    timeval_t _idle_timeout;
 };
 
-inline Coroutine *Coroutine::spawn(Coroutine::routine_t routine, void *ud) noexcept {
-    return _mgr->spawn(routine, ud);
+inline Coroutine *Coroutine::spawn(Coroutine::routine_t routine, void *ud, unsigned stack_class) noexcept {
+    return _mgr->spawn(routine, ud, stack_class);
 }
 
 inline bool Coroutine::resume() noexcept {
@@ -114,6 +195,48 @@ inline Coroutine *Coroutine::self() noexcept {
 inline bool Coroutine::is_main_routine() noexcept {
     return _mgr->is_main_routine();
 }
+inline void Coroutine::schedule() noexcept {
+    _mgr->schedule(this);
+}
+inline size_t Coroutine::run() noexcept {
+    return _mgr->run();
+}
+inline void Coroutine::post(void (*fn)(void*), void *arg) noexcept {
+    _mgr->post(fn, arg);
+}
+inline size_t Coroutine::runnable() noexcept {
+    return _mgr->_ready_count + _mgr->_posted.size();
+}
+inline void Coroutine::budget(size_t value) noexcept {
+    _mgr->_budget = value;
+}
+inline size_t Coroutine::budget() noexcept {
+    return _mgr->_budget;
+}
+inline void Coroutine::profile(bool value) noexcept {
+    _mgr->_profile = value;
+}
+inline bool Coroutine::profile() noexcept {
+    return _mgr->_profile;
+}
+inline void Coroutine::limit(size_t value) noexcept {
+    _mgr->_limit = value;
+}
+inline size_t Coroutine::limit() noexcept {
+    return _mgr->_limit;
+}
+inline size_t Coroutine::count() noexcept {
+    return _mgr->_coroutines.size();
+}
+inline void Coroutine::idle_timeout(timeval_t value) noexcept {
+    _mgr->_idle_timeout = value;
+}
+inline timeval_t Coroutine::idle_timeout() noexcept {
+    return _mgr->_idle_timeout;
+}
+inline size_t Coroutine::shrink() noexcept {
+    return _mgr->shrink();
+}
 
 GX_NS_END
 
@@ -0,0 +1,139 @@
+#include "eventloop.h"
+#include "application.h"
+#include "log.h"
+
+#ifndef GX_PLATFORM_WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+GX_NS_BEGIN
+
+thread_local EventLoop *EventLoop::_current;
+
+EventLoop::EventLoop(unsigned index) noexcept
+: _index(index)
+{ }
+
+EventLoop::~EventLoop() noexcept {
+    join();
+}
+
+bool EventLoop::start(int type, unsigned id) noexcept {
+    std::promise<bool> ready;
+    std::future<bool> result = ready.get_future();
+    _thread = std::thread(&EventLoop::routine, this, type, id, &ready);
+    if (!result.get()) {
+        _thread.join();
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::join() noexcept {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+bool EventLoop::init(int type, unsigned id) noexcept {
+    adjust_time();
+#if GX_MT
+    /* adopted for the thread, it outlives the loop for the pages and
+     * remote batches other threads still hold
+     */
+    PageAllocator::instance();
+#else
+    _pa = object<PageAllocator>();
+    PageAllocator::local(_pa);
+#endif
+    _comgr = object<CoManager>();
+    Coroutine::init(_comgr);
+    _timermgr = object<TimerManager>();
+    _reactor = object<Reactor>(_timermgr);
+    _network = object<Network>();
+
+    Script *script = nullptr;
+#ifdef GX_USE_LUA
+    script = the_app->script();
+#endif
+    if (!_network->init(script, _timermgr, _reactor)) {
+        log_error("init network of loop %u failed.", _index);
+        return false;
+    }
+    _network->reuse_port(true);
+    /* connects too, this loop's calls need peers of its own */
+    if (!_network->startup(type, id)) {
+        return false;
+    }
+    the_app->init_coroutines(_timermgr);
+    the_app->init_pages(_timermgr);
+    the_app->init_flush(_reactor);
+
+    /* wake up periodically, the termination signal is delivered to the main loop only. */
+    _timermgr->schedule(idle_interval, [](Timer&, timeval_t) {
+        return idle_interval;
+    });
+    return true;
+}
+
+bool EventLoop::loop() noexcept {
+    timeval_t t = _timermgr->loop();
+    if (Coroutine::runnable()) {
+        t = 0;
+    }
+    if (_reactor->loop(t) < 0) {
+        return false;
+    }
+    /* coroutines woken by timers and I/O run after the whole batch */
+    Coroutine::run();
+    /* pages this loop freed for other threads go back to them */
+    PageAllocator::flush();
+    return true;
+}
+
+void EventLoop::finish() noexcept {
+    _network = nullptr;
+    _reactor = nullptr;
+    _timermgr = nullptr;
+    _comgr = nullptr;
+    Context::release_pools();
+#if !GX_MT
+    PageAllocator::local(nullptr);
+    _pa = nullptr;
+#endif
+}
+
+void EventLoop::routine(int type, unsigned id, std::promise<bool> *ready) noexcept {
+#ifndef GX_PLATFORM_WIN32
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+#endif
+    _current = this;
+    if (!init(type, id)) {
+        finish();
+        ready->set_value(false);
+        return;
+    }
+    ready->set_value(true);
+
+    while (!the_app->termed()) {
+        if (!loop()) {
+            break;
+        }
+    }
+
+    _network->shutdown_servlets();
+    while (_network->call_count()) {
+        loop();
+    }
+    _timermgr->clear();
+    finish();
+    _current = nullptr;
+}
+
+GX_NS_END
+
@@ -0,0 +1,77 @@
+#ifndef __GX_EVENTLOOP_H__
+#define __GX_EVENTLOOP_H__
+
+#include <thread>
+#include <future>
+#include "platform.h"
+#include "object.h"
+#include "memory.h"
+#include "page.h"
+#include "timermanager.h"
+#include "reactor.h"
+#include "coroutine.h"
+#include "network.h"
+
+GX_NS_BEGIN
+
+/* EventLoop
+ * An extra reactor thread of the application. Every loop owns its
+ * PageAllocator (adopts one with GX_MT), TimerManager, Reactor, CoManager
+ * and Network, and listens on the same addresses as the main loop through
+ * SO_REUSEPORT, so the kernel spreads accepted connections across loops.
+ * Peers never leave the loop which accepted or connected them.
+ *
+ * A loop's calls go out through its own peers and call table, so every
+ * loop connects to every remote instance: N loops make N times the
+ * inter-node connections, which the remote side spreads over its own
+ * loops in turn. Sharing one loop's peers would put a lock or a hop
+ * between threads on every call.
+ */
+class EventLoop : public Object {
+public:
+    static constexpr const timeval_t idle_interval = 100;
+public:
+    EventLoop(unsigned index) noexcept;
+    ~EventLoop() noexcept;
+
+    unsigned index() const noexcept {
+        return _index;
+    }
+    ptr<TimerManager> timer_manager() const noexcept {
+        return _timermgr;
+    }
+    ptr<Reactor> reactor() const noexcept {
+        return _reactor;
+    }
+    ptr<Network> network() const noexcept {
+        return _network;
+    }
+    bool start(int type, unsigned id) noexcept;
+    void join() noexcept;
+
+    static EventLoop *current() noexcept {
+        return _current;
+    }
+private:
+    void routine(int type, unsigned id, std::promise<bool> *ready) noexcept;
+    bool init(int type, unsigned id) noexcept;
+    bool loop() noexcept;
+    void finish() noexcept;
+
+private:
+    unsigned _index;
+    std::thread _thread;
+#if !GX_MT
+    ptr<PageAllocator> _pa;
+#endif
+    ptr<CoManager> _comgr;
+    ptr<TimerManager> _timermgr;
+    ptr<Reactor> _reactor;
+    ptr<Network> _network;
+    static thread_local EventLoop *_current;
+};
+
+GX_NS_END
+
+#endif
+
@@ -0,0 +1,162 @@
+#ifndef __GX_FUNCTION_H__
+#define __GX_FUNCTION_H__
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "platform.h"
+
+GX_NS_BEGIN
+
+template <typename _Sig, std::size_t _Size = 48>
+class inline_function;
+
+/* inline_function
+ * std::function with _Size bytes of inline storage, so a handler binding a
+ * member function and a couple of pointers is stored without allocation.
+ * Larger (or throwing-move) functors still go to the heap.
+ */
+template <typename _R, typename ..._Args, std::size_t _Size>
+class inline_function<_R(_Args...), _Size> {
+    struct ops_type {
+        _R (*call)(void *p, _Args... args);
+        void (*move)(void *dst, void *src) noexcept;
+        void (*copy)(void *dst, const void *src);
+        void (*destroy)(void *p) noexcept;
+    };
+
+    template <typename _F>
+    struct local {
+        static _F *get(void *p) noexcept {
+            return static_cast<_F*>(p);
+        }
+        static _R call(void *p, _Args... args) {
+            return (*get(p))(std::forward<_Args>(args)...);
+        }
+        static void move(void *dst, void *src) noexcept {
+            new(dst) _F(std::move(*get(src)));
+            get(src)->~_F();
+        }
+        static void copy(void *dst, const void *src) {
+            new(dst) _F(*static_cast<const _F*>(src));
+        }
+        static void destroy(void *p) noexcept {
+            get(p)->~_F();
+        }
+    };
+
+    template <typename _F>
+    struct remote {
+        static _F *&get(void *p) noexcept {
+            return *static_cast<_F**>(p);
+        }
+        static _R call(void *p, _Args... args) {
+            return (*get(p))(std::forward<_Args>(args)...);
+        }
+        static void move(void *dst, void *src) noexcept {
+            *static_cast<_F**>(dst) = get(src);
+        }
+        static void copy(void *dst, const void *src) {
+            *static_cast<_F**>(dst) = new _F(**static_cast<_F* const*>(src));
+        }
+        static void destroy(void *p) noexcept {
+            delete get(p);
+        }
+    };
+
+    template <typename _F>
+    struct is_local : std::integral_constant<bool,
+        sizeof(_F) <= _Size &&
+        alignof(std::max_align_t) % alignof(_F) == 0 &&
+        std::is_nothrow_move_constructible<_F>::value>
+    { };
+
+    template <typename _F, typename _Impl>
+    static const ops_type *ops() noexcept {
+        static const ops_type the_ops = {
+            _Impl::call, _Impl::move, _Impl::copy, _Impl::destroy,
+        };
+        return &the_ops;
+    }
+
+public:
+    inline_function() noexcept : _ops() { }
+    inline_function(std::nullptr_t) noexcept : _ops() { }
+
+    template <typename _F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<_F>::type, inline_function>::value>::type>
+    inline_function(_F &&f) : _ops() {
+        assign(std::forward<_F>(f), is_local<typename std::decay<_F>::type>());
+    }
+
+    inline_function(const inline_function &x) : _ops(x._ops) {
+        if (_ops) {
+            _ops->copy(_buf, x._buf);
+        }
+    }
+    inline_function(inline_function &&x) noexcept : _ops(x._ops) {
+        if (_ops) {
+            _ops->move(_buf, x._buf);
+            x._ops = nullptr;
+        }
+    }
+    ~inline_function() noexcept {
+        reset();
+    }
+
+    inline_function &operator=(const inline_function &x) {
+        if (this != &x) {
+            inline_function tmp(x);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+    inline_function &operator=(inline_function &&x) noexcept {
+        if (this != &x) {
+            reset();
+            if ((_ops = x._ops)) {
+                _ops->move(_buf, x._buf);
+                x._ops = nullptr;
+            }
+        }
+        return *this;
+    }
+    inline_function &operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    explicit operator bool() const noexcept {
+        return _ops != nullptr;
+    }
+    _R operator()(_Args... args) const {
+        return _ops->call(const_cast<char*>(_buf), std::forward<_Args>(args)...);
+    }
+private:
+    void reset() noexcept {
+        if (_ops) {
+            _ops->destroy(_buf);
+            _ops = nullptr;
+        }
+    }
+    template <typename _F>
+    void assign(_F &&f, std::true_type) {
+        typedef typename std::decay<_F>::type type;
+        new(_buf) type(std::forward<_F>(f));
+        _ops = ops<type, local<type>>();
+    }
+    template <typename _F>
+    void assign(_F &&f, std::false_type) {
+        typedef typename std::decay<_F>::type type;
+        *reinterpret_cast<type**>(_buf) = new type(std::forward<_F>(f));
+        _ops = ops<type, remote<type>>();
+    }
+private:
+    alignas(std::max_align_t) char _buf[_Size];
+    const ops_type *_ops;
+};
+
+GX_NS_END
+
+#endif
+
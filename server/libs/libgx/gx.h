@@ -7,6 +7,7 @@
 #include "memory.h"
 #include "hash.h"
 #include "list.h"
+#include "function.h"
 #include "singleton.h"
 #include "bitorder.h"
 #include "page.h"
@@ -15,6 +16,7 @@
 #include "allocator.h"
 #include "io.h"
 #include "stream.h"
+#include "payload.h"
 #include "path.h"
 #include "gxgetopt.h"
 #include "data.h"
@@ -23,14 +25,17 @@
 #include "timermanager.h"
 #include "script.h"
 #include "application.h"
+#include "eventloop.h"
 #include "csvloader.h"
 #include "utils.h"
+#include "shm.h"
 #include "network.h"
 #include "filemonitor.h"
 #include "protocol.h"
 #include "mysql.h"
 #include "rc.h"
 #include "servlet.h"
+#include "task.h"
 #include "prob.h"
 #include "coroutine.h"
 #include "bitstr.h"
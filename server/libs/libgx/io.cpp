@@ -60,5 +60,35 @@ void fd_nodelay(fd_t fd, bool value) noexcept {
 #endif
 }
 
+/* IO */
+int IO::readv(const struct iovec *iov, int count) noexcept {
+    int total = 0;
+    for (int i = 0; i < count; ++i) {
+        int n = read(iov[i].iov_base, iov[i].iov_len);
+        if (n <= 0) {
+            return total ? total : n;
+        }
+        total += n;
+        if ((size_t)n < iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+
+int IO::writev(const struct iovec *iov, int count) noexcept {
+    int total = 0;
+    for (int i = 0; i < count; ++i) {
+        int n = write((const char*)iov[i].iov_base, iov[i].iov_len);
+        if (n <= 0) {
+            return total ? total : n;
+        }
+        total += n;
+        if ((size_t)n < iov[i].iov_len) {
+            break;
+        }
+    }
+    return total;
+}
 
 GX_NS_END
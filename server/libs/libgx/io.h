@@ -5,6 +5,7 @@
 
 #ifndef GX_PLATFORM_WIN32
     #include <unistd.h>
+    #include <sys/uio.h>
 #endif
 
 GX_NS_BEGIN
@@ -37,6 +38,17 @@ inline int fd_write(fd_t fd, const char *buf, size_t size) noexcept {
 #endif
 }
 
+#ifndef GX_PLATFORM_WIN32
+/* Winsock has no iovec, Socket falls back to the IO:: loops there */
+inline int fd_readv(fd_t fd, const struct iovec *iov, int count) noexcept {
+    return ::readv(fd, iov, count);
+}
+
+inline int fd_writev(fd_t fd, const struct iovec *iov, int count) noexcept {
+    return ::writev(fd, iov, count);
+}
+#endif
+
 void fd_close(fd_t fd) noexcept;
 void fd_block(fd_t fd, bool value) noexcept;
 void fd_nodelay(fd_t fd, bool value) noexcept;
@@ -45,6 +57,8 @@ class IO {
 public:
     virtual int read(void *buf, size_t size) noexcept = 0;
     virtual int write(const char *buf, size_t size) noexcept = 0;
+    virtual int readv(const struct iovec *iov, int count) noexcept;
+    virtual int writev(const struct iovec *iov, int count) noexcept;
     virtual void close() noexcept = 0;
 };
 
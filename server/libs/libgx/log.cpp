@@ -151,7 +151,7 @@ void print_back_trace() noexcept {
 }
 #endif
 
-UdpLogPrinter::UdpLogPrinter() {
+UdpLogPrinter::UdpLogPrinter() : _buf(1, _pa) {
     _socket = socket(AF_INET, SOCK_DGRAM, 0);
     _name = the_app->name();
     _name_size = strlen(_name);
@@ -162,19 +162,20 @@ UdpLogPrinter::~UdpLogPrinter() {
 }
 
 void UdpLogPrinter::vprintf(int level, const char *file, size_t line, const char *fmt, va_list ap) noexcept {
-    timeval_t t = gettimeofday();
-    _pool.grow(&level, 1);
-    _pool.grow(t);
-    _pool.grow(&_name_size, 1);
-    _pool.grow0(_name, _name_size);
-    _pool.grow1(the_app->id());
-    _pool.vprint(fmt, ap);
-    _pool.grow1(0);
-    unsigned size = _pool.object_size();
-    char *p = (char*)_pool.finish();
+    timeval_t t = walltime();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buf.grow(&level, 1);
+    _buf.grow(t);
+    _buf.grow(&_name_size, 1);
+    _buf.grow0(_name, _name_size);
+    _buf.grow1(the_app->id());
+    _buf.vprint(fmt, ap);
+    _buf.grow1(0);
+    unsigned size = _buf.object_size();
+    char *p = (char*)_buf.finish();
 
     ::sendto(_socket, p, size, 0, the_app->log_addr(), Address::length);
-    _pool.clear();
+    _buf.clear();
 }
 
 GX_NS_END
@@ -2,6 +2,7 @@
 #define __GX_LOG_H__
 
 #include <cstdarg>
+#include <mutex>
 #include "platform.h"
 #include "memory.h"
 #include "obstack.h"
@@ -35,6 +36,10 @@ public:
     ~UdpLogPrinter();
     void vprintf(int level, const char *file, size_t line, const char *fmt, va_list ap) noexcept override;
 protected:
+    /* event loops log concurrently, the pool has its own page allocator. */
+    object<PageAllocator> _pa;
+    Obstack _buf;
+    std::mutex _mutex;
     fd_t _socket;
     const char *_name;
     unsigned _name_size;
@@ -9,6 +9,7 @@
 
 #ifndef GX_PLATFORM_WIN32
 #include <unistd.h>
+#include <cerrno>
 #endif
 
 #include "script.h"
@@ -41,7 +42,21 @@ bool NetworkInstance::listen(ptr<Reactor> reactor) noexcept {
         return false;
     }
     _listener = object<Listener>(addr, reactor, std::bind(&NetworkInstance::on_accept, this, _1, _2, _3));
-    return _listener->listen();
+    _listener->reuse_port(_network->reuse_port());
+    if (!_listener->listen()) {
+        return false;
+    }
+#ifdef GX_NETWORK_USE_SHM
+    /* only one process can own the name, the others keep to tcp */
+    fd_t fd = ShmChannel::listen(addr);
+    if (!fd_valid(fd)) {
+        log_debug("shared memory listen %s:%d failed, errno %d.", addr.host(), addr.port(), errno);
+    }
+    else if (!(_shm_listener = reactor->open(fd, Reactor::poll_in | Reactor::poll_err, std::bind(&NetworkInstance::on_shm_accept, this, _1, _2)))) {
+        fd_close(fd);
+    }
+#endif
+    return true;
 }
 
 bool NetworkInstance::connect() noexcept {
@@ -54,6 +69,11 @@ bool NetworkInstance::connect() noexcept {
             _timeout, _interval,
             std::bind(&NetworkInstance::on_connection, this, _1, _2));
     }
+#ifdef GX_NETWORK_USE_SHM
+    if (shm_connect()) {
+        return true;
+    }
+#endif
 
     log_debug("connect to %s[%d] = %s:%d.", _node->name(), id(), _conn_addr.host(), _conn_addr.port());
     return _connector->connect();
@@ -65,6 +85,8 @@ bool NetworkInstance::on_connection(Socket *socket, int flags) noexcept {
         assert(!_peer);
         ptr<Peer> peer = object<Peer>(false);
         peer->_socket = socket;
+        peer->_network = _network;
+        socket->watermark(_network->_high_watermark, _network->_low_watermark);
         socket->handler(std::bind(&NetworkInstance::on_data, this, peer, _1, _2));
         socket->flags(-1);
         assert(!_peer);
@@ -86,12 +108,111 @@ bool NetworkInstance::on_accept(int fd, unsigned flags, const Address &addr) noe
         Socket *socket = _listener->reactor()->open(fd, -1, std::bind(&NetworkInstance::on_data, this, peer, _1, _2));
         peer->_socket = socket;
         peer->_network = _network;
+        if (socket) {
+            socket->watermark(_network->_high_watermark, _network->_low_watermark);
+        }
         _network->_accept_list.push_front(peer);
     }
 
     return true;
 }
 
+#ifdef GX_NETWORK_USE_SHM
+bool NetworkInstance::shm_connect() noexcept {
+    if (!ShmChannel::is_local(_conn_addr)) {
+        return false;
+    }
+    fd_t fd = ShmChannel::connect(_conn_addr);
+    if (!fd_valid(fd)) {
+        return false;
+    }
+    fd_t memfd;
+    object<ShmChannel> shm;
+    if (!shm->create(memfd)) {
+        fd_close(fd);
+        return false;
+    }
+    bool sent = ShmChannel::send_fd(fd, memfd);
+    fd_close(memfd);
+    if (!sent) {
+        fd_close(fd);
+        return false;
+    }
+    Socket *socket = _network->_reactor->open(fd, -1 & ~Reactor::poll_direct, [](Socket&, unsigned) {
+        return true;
+    });
+    if (!socket) {
+        fd_close(fd);
+        return false;
+    }
+    socket->attach(shm);
+    log_debug("connect %s[%d] = %s:%d over shared memory.", _node->name(), id(), _conn_addr.host(), _conn_addr.port());
+    return on_connection(socket, Reactor::poll_out);
+}
+
+bool NetworkInstance::on_shm_accept(Socket &socket, unsigned flags) noexcept {
+    if (flags & Reactor::poll_close) {
+        fd_close(socket.fd());
+        return false;
+    }
+    if (flags & Reactor::poll_err) {
+        return false;
+    }
+    if (flags & Reactor::poll_in) {
+        Address addr;
+        while (1) {
+            fd_t fd = socket.accept(addr);
+            if (!fd_valid(fd)) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno == EAGAIN;
+            }
+            if (!socket.reactor()->open(fd, -1 & ~Reactor::poll_direct, std::bind(&NetworkInstance::on_shm_handshake, this, _1, _2))) {
+                fd_close(fd);
+            }
+        }
+    }
+    return true;
+}
+
+bool NetworkInstance::on_shm_handshake(Socket &socket, unsigned flags) noexcept {
+    if (flags & Reactor::poll_close) {
+        fd_close(socket.fd());
+        return false;
+    }
+    if (flags & Reactor::poll_err) {
+        return false;
+    }
+    if (!(flags & Reactor::poll_in)) {
+        return true;
+    }
+    fd_t memfd = ShmChannel::recv_fd(socket.fd());
+    if (!fd_valid(memfd)) {
+        return errno == EAGAIN;
+    }
+    object<ShmChannel> shm;
+    bool attached = shm->attach(memfd);
+    fd_close(memfd);
+    if (!attached) {
+        log_warning("socket %d bad shared memory handshake.", socket.fd());
+        return false;
+    }
+
+    log_debug("accept shared memory channel at socket %d.", socket.fd());
+    ptr<Peer> peer = object<Peer>(is_ap());
+    peer->_socket = &socket;
+    peer->_network = _network;
+    socket.attach(shm);
+    socket.watermark(_network->_high_watermark, _network->_low_watermark);
+    socket.handler(std::bind(&NetworkInstance::on_data, this, peer, _1, _2));
+    _network->_accept_list.push_front(peer);
+
+    /* the connector may have written before the channel was attached */
+    return on_data(peer, socket, Reactor::poll_in | Reactor::poll_out);
+}
+#endif
+
 bool NetworkInstance::on_data(ptr<Peer> peer, Socket &socket, int flags) noexcept {
     int n;
     if (flags & Reactor::poll_close) {
@@ -111,6 +232,13 @@ bool NetworkInstance::on_data(ptr<Peer> peer, Socket &socket, int flags) noexcep
     if (flags & Reactor::poll_err) {
         return false;
     }
+    if (flags & (Reactor::poll_high | Reactor::poll_low)) {
+        bool congested = flags & Reactor::poll_high;
+        if (congested) {
+            log_warning("socket %d output congested, %lu bytes pending.", socket.fd(), (unsigned long)socket.output().size());
+        }
+        peer->on_congested(congested);
+    }
     if (flags & Reactor::poll_out) {
         socket.send();
     }
@@ -215,6 +343,8 @@ bool Network::init(Script *script, ptr<TimerManager> timermgr, ptr<Reactor> reac
     _timermgr = timermgr;
     _reactor = reactor;
     _rpc_timeout = 3000;
+    _high_watermark = default_high_watermark;
+    _low_watermark = default_low_watermark;
     return true;
 #else
 	return false;
@@ -257,6 +387,11 @@ void Network::shutdown_servlets() noexcept {
     instance->_listener->close();
     instance = node->_instances[_id];
     instance->_listener->close();
+#ifdef GX_NETWORK_USE_SHM
+    if (instance->_shm_listener) {
+        instance->_shm_listener->close();
+    }
+#endif
 
     Peer *peer;
     while ((peer = _accept_list.pop_front())) {
@@ -303,90 +438,211 @@ void Network::broadcast(unsigned servlet, const INotify *req) noexcept {
         seq = _seq = 1;
     }
 
+    /* serialize once, every peer links the same frame */
+    ptr<Payload> payload;
     for (auto &instance : pservlet->_instances) {
         if (instance->_peer) {
-            instance->_peer->send(servlet, seq, req);
+            if (!payload) {
+                ProtocolInfo info;
+                info.servlet = servlet;
+                info.seq = seq;
+                info.message = req;
+                payload = object<Payload>();
+                Protocol().serial(info, payload->stream(), false);
+            }
+            instance->_peer->send(payload);
         }
     }
 }
 
 void Network::call(uint64_t id, unsigned servlet, IRequest *req, IResponse *rsp, NetworkInstance *instance) {
-    unsigned seq;
-
     assert(!Coroutine::is_main_routine());
 
+    Call call(id, servlet, req, rsp, instance);
+    Context *ctx = the_context();
+    bool waited = call_start(ctx, &call);
+    bool resumed = true;
+    if (waited) {
+        resumed = Coroutine::yield();
+    }
+    call_finish(ctx, &call, waited, resumed);
+}
+
+bool Network::call_start(Context *ctx, Call *call) {
+    NetworkInstance *instance = call->instance;
     if (!instance) {
-        instance = servlet_lb(GX_SERVLET_TYPE(servlet), id);
+        instance = servlet_lb(GX_SERVLET_TYPE(call->servlet), call->id);
         if (!instance) {
-            log_debug("send call failed, servlet = %x.", servlet);
+            log_debug("send call failed, servlet = %x.", call->servlet);
             throw ServletException(GX_EBUSY);
         }
     }
 
-    Peer *peer = send(id, servlet, req, &seq, instance);
+    call->ctx = ctx;
+    call->seq = 0;
+    call->result = GX_CALL_UNKNOWN;
+    ctx->_call_result = GX_CALL_UNKNOWN;
+
+    /* a local call has no seq and no rpc timeout, the servlet's own calls have theirs */
+    if (instance->_is_local && ServletManager::instance()->call(this, call, ctx)) {
+        log_debug("call local, servlet = %x.", call->servlet);
+        if (call->result != GX_CALL_UNKNOWN) {
+            return false;
+        }
+        ctx->_call_wait = 1;
+        ++_call_count;
+        return true;
+    }
+
+    Peer *peer = send(call->id, call->servlet, call->req, &call->seq, instance);
     if (!peer) {
-        log_debug("send call failed, servlet = %x, seq = %d.", servlet, seq);
+        log_debug("send call failed, servlet = %x, seq = %d.", call->servlet, call->seq);
         throw ServletException(GX_EBUSY);
     }
 
-    Context *ctx = the_context();
-    auto r = _call_map.emplace(seq, ctx);
-    if (!r.second) {
-        log_debug("dup call seq, servlet = %x, seq = %d.", servlet, seq);
+    /* the response is read by response_handler, the caller only gets woken */
+    if (!_calls.insert(call->seq, ctx, call)) {
+        log_debug("dup call seq, servlet = %x, seq = %d.", call->servlet, call->seq);
         throw ServletException(GX_EBUSY);
     }
 
-    log_debug("send call, servlet = %x, seq = %d.", servlet, seq);
+    log_debug("send call, servlet = %x, seq = %d.", call->servlet, call->seq);
 
-    ctx->_call_result = GX_CALL_UNKNOWN;
+    peer->_call_list.push_front(call);
+    ctx->_call_wait = 1;
     ctx->_timer = _timermgr->schedule(_rpc_timeout, std::bind(&Network::call_timeout_handler, this, ctx, _1, _2));
-
-    peer->_call_list.push_front(ctx);
     ++_call_count;
-    if (!Coroutine::yield()) {
-        ctx->_timer->close();
-        _call_map.erase(seq);
-        log_debug("send call yield failed.");
-        throw ServletException(GX_EBUSY);
-    }
-    --_call_count;
-    Peer::ctx_list_t::remove(ctx);
+    return true;
+}
 
-    _call_map.erase(r.first);
-    if (ctx->_timer) {
-        ctx->_timer->close();
+void Network::call_finish(Context *ctx, Call *call, bool waited, bool resumed) {
+    if (waited) {
+        --_call_count;
+        ctx->_call_wait = 0;
+        if (ctx->_timer) {
+            ctx->_timer->close();
+        }
+    }
+    /* only an answered call has left the table already */
+    if (call->result != GX_CALL_OK && call->seq) {
+        _calls.remove(call->seq);
+    }
+    if (call->result == GX_CALL_UNKNOWN) {
+        if (call->seq) {
+            Peer::call_list_t::remove(call);
+        }
+        if (!resumed) {
+            log_debug("send call yield failed.");
+            throw ServletException(GX_EBUSY);
+        }
+        call->result = ctx->_call_result == GX_CALL_TIMEDOUT ? GX_CALL_TIMEDOUT : GX_CALL_CANCEL;
     }
 
-    switch (ctx->_call_result) {
+    switch (call->result) {
     case GX_CALL_OK:
-        log_debug("recv response, servlet = %x, seq = %d.", servlet, seq);
-        if (rsp->read_rc(peer->input())) {
-            if (rsp->rc) {
-                return;
-            }
-            if (rsp->unserial(peer->input(), ctx->pool())) {
-                return;
+        log_debug("recv response, servlet = %x, seq = %d.", call->servlet, call->seq);
+        return;
+    case GX_CALL_TIMEDOUT:
+        log_debug("call '%d' timedout.", call->seq);
+        throw ServletException(GX_ETIMEOUT);
+    default:
+        log_debug("call '%d' cancelled.", call->seq);
+        throw CallCancelException();
+    }
+}
+
+bool Network::post(uint64_t id, unsigned servlet, const INotify *req, NetworkInstance *instance) noexcept {
+    if (!instance) {
+        instance = servlet_lb(GX_SERVLET_TYPE(servlet), id);
+        if (!instance) {
+            return false;
+        }
+    }
+    if (instance->_is_local && !Coroutine::is_main_routine()) {
+        /* the pool outlives the sender for as long as the servlet needs it */
+        Context *ctx = the_context();
+        Call *call = ctx->pool()->construct<Call>(id, servlet, const_cast<INotify*>(req), nullptr, instance);
+        if (ServletManager::instance()->call(this, call, ctx)) {
+            log_debug("post local, servlet = %x.", servlet);
+            return true;
+        }
+    }
+    if (!instance->_peer) {
+        return false;
+    }
+    return send(id, servlet, req, nullptr, instance) != nullptr;
+}
+
+unsigned Network::call_all(Call *calls, unsigned count, unsigned wait) {
+    assert(!Coroutine::is_main_routine());
+
+    Context *ctx = the_context();
+    unsigned done = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        Call &call = calls[i];
+        call.ctx = ctx;
+        call.result = GX_CALL_UNKNOWN;
+        call.seq = 0;
+
+        NetworkInstance *instance = call.instance;
+        if (!instance) {
+            instance = servlet_lb(GX_SERVLET_TYPE(call.servlet), call.id);
+        }
+        Peer *peer = instance ? send(call.id, call.servlet, call.req, &call.seq, instance) : nullptr;
+        if (!peer || !_calls.insert(call.seq, ctx, &call)) {
+            log_debug("send call failed, servlet = %x.", call.servlet);
+            /* not in the table, the seq may be a live call's */
+            call.seq = 0;
+            call.result = GX_CALL_CANCEL;
+            done++;
+            continue;
+        }
+        log_debug("send call, servlet = %x, seq = %d.", call.servlet, call.seq);
+        peer->_call_list.push_front(&call);
+    }
+
+    if (!wait || wait > count) {
+        wait = count;
+    }
+    ctx->_call_result = GX_CALL_UNKNOWN;
+    if (done < wait) {
+        ctx->_call_wait = wait - done;
+        ctx->_timer = _timermgr->schedule(_rpc_timeout, std::bind(&Network::call_timeout_handler, this, ctx, _1, _2));
+        ++_call_count;
+        bool resumed = Coroutine::yield();
+        --_call_count;
+        ctx->_call_wait = 0;
+        if (ctx->_timer) {
+            ctx->_timer->close();
+        }
+        if (!resumed) {
+            ctx->_call_result = GX_CALL_CANCEL;
+        }
+    }
+
+    /* calls still in flight are forgotten, late responses get dropped.
+     * Cancelled ones leave the table too, their peer may be gone.
+     */
+    unsigned ok = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        Call &call = calls[i];
+        if (call.result != GX_CALL_OK && call.seq) {
+            _calls.remove(call.seq);
+        }
+        if (call.result == GX_CALL_UNKNOWN) {
+            Peer::call_list_t::remove(&call);
+            if (ctx->_call_result == GX_CALL_TIMEDOUT) {
+                call.result = GX_CALL_TIMEDOUT;
             }
-            else {
-                log_error("read response failed, input size = %lu", peer->input().size());
+            else if (ctx->_call_result == GX_CALL_CANCEL) {
+                call.result = GX_CALL_CANCEL;
             }
         }
-        else {
-            log_error("read response rc failed, input size = %lu", peer->input().size());
+        else if (call.result == GX_CALL_OK) {
+            ok++;
         }
-        peer->close();
-        throw CallCancelException();
-    case GX_CALL_TIMEDOUT:
-        log_debug("call '%d' timedout.", seq);
-        throw ServletException(GX_ETIMEOUT);
-    case GX_CALL_CANCEL:
-        log_debug("call '%d' cancelled.", seq);
-        throw CallCancelException();
-    default:
-        log_debug("call unknown error");
-        assert(0);
-        return;
     }
+    return ok;
 }
 
 timeval_t Network::call_timeout_handler(Context *ctx, Timer&, timeval_t) noexcept {
@@ -400,16 +656,33 @@ inline void Network::request_handler(ProtocolInfo &info, Peer *peer, Stream&) no
 }
 
 inline void Network::response_handler(ProtocolInfo &info, Peer *peer, Stream &stream) noexcept {
-    auto it = _call_map.find(info.seq);
-    if (it == _call_map.end()) {
+    Call *call = nullptr;
+    Context *ctx = _calls.find(info.seq, &call);
+    if (!ctx) {
         log_debug("can't find call seq '%d'.", info.seq);
         stream.read(nullptr, info.size);
         return;
     }
     log_debug("on response servlet = %x, seq = %d, size = %d", info.servlet, info.seq, info.size);
-    Context *ctx = it->second;
-    assert(ctx);
-    ctx->call_ok();
+    assert(call);
+    /* responses are read here, the caller runs later and may still be waiting for others */
+    _calls.remove(info.seq);
+    Peer::call_list_t::remove(call);
+    size_t size = stream.size();
+    IResponse *rsp = call->rsp;
+    if (rsp->read_rc(stream) && (rsp->rc || rsp->unserial(stream, ctx->pool()))) {
+        call->result = GX_CALL_OK;
+        size -= stream.size();
+        if (size < info.size) {
+            stream.read(nullptr, info.size - size);
+        }
+    }
+    else {
+        log_error("read response failed, input size = %lu", stream.size());
+        call->result = GX_CALL_CANCEL;
+        peer->close();
+    }
+    ctx->call_done();
 }
 
 bool Network::ready() noexcept {
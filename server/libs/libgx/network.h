@@ -3,7 +3,6 @@
 
 
 #include <vector>
-#include <unordered_map>
 #include "platform.h"
 #include "singleton.h"
 #include "reactor.h"
@@ -67,6 +66,11 @@ private:
     bool on_connection(Socket *socket, int flags) noexcept;
     bool on_accept(int, unsigned, const Address&) noexcept;
     bool on_data(ptr<Peer>, Socket&, int flags) noexcept;
+#ifdef GX_NETWORK_USE_SHM
+    bool shm_connect() noexcept;
+    bool on_shm_accept(Socket&, unsigned flags) noexcept;
+    bool on_shm_handshake(Socket&, unsigned flags) noexcept;
+#endif
 private:
     unsigned _id;
     std::string _host;
@@ -75,6 +79,9 @@ private:
     timeval_t _interval;
     ptr<Connector> _connector;
     ptr<Listener> _listener;
+#ifdef GX_NETWORK_USE_SHM
+    weak_ptr<Socket> _shm_listener;
+#endif
     bool _ap;
     weak_ptr<Peer> _peer;
     Network *_network;
@@ -145,8 +152,95 @@ private:
     NetworkServlets _servlets;
 };
 
+/* CallTable
+ * In-flight calls indexed by seq & mask. Each slot keeps the full seq, so a
+ * response for a finished or unknown call never matches a newer one. The
+ * table doubles when a live call sits in the slot a new seq maps to.
+ */
+class CallTable {
+public:
+    static constexpr const unsigned initial_size = 1024;
+public:
+    CallTable() noexcept : _slots(initial_size), _mask(initial_size - 1)
+    { }
+
+    bool insert(unsigned seq, Context *ctx, Call *call = nullptr) noexcept {
+        slot *s = &_slots[seq & _mask];
+        while (gx_unlikely(s->ctx)) {
+            if (s->seq == seq) {
+                return false;
+            }
+            grow();
+            s = &_slots[seq & _mask];
+        }
+        s->seq = seq;
+        s->ctx = ctx;
+        s->call = call;
+        return true;
+    }
+    Context *find(unsigned seq, Call **call = nullptr) const noexcept {
+        const slot &s = _slots[seq & _mask];
+        if (s.seq != seq) {
+            return nullptr;
+        }
+        if (call) {
+            *call = s.call;
+        }
+        return s.ctx;
+    }
+    void remove(unsigned seq) noexcept {
+        slot &s = _slots[seq & _mask];
+        if (s.seq == seq) {
+            s.ctx = nullptr;
+        }
+    }
+    size_t capacity() const noexcept {
+        return _slots.size();
+    }
+private:
+    struct slot {
+        slot() noexcept : seq(), ctx(), call() { }
+        unsigned seq;
+        Context *ctx;
+        Call *call;
+    };
+    void grow() noexcept {
+        std::vector<slot> slots;
+        unsigned mask;
+        for (unsigned size = _slots.size() << 1; ; size <<= 1) {
+            slots.clear();
+            slots.resize(size);
+            mask = size - 1;
+            bool ok = true;
+            for (auto &s : _slots) {
+                if (!s.ctx) {
+                    continue;
+                }
+                slot &d = slots[s.seq & mask];
+                if (d.ctx) {
+                    ok = false;
+                    break;
+                }
+                d = s;
+            }
+            if (ok) {
+                break;
+            }
+        }
+        _slots.swap(slots);
+        _mask = mask;
+    }
+private:
+    std::vector<slot> _slots;
+    unsigned _mask;
+};
+
 class Network : public Object {
     friend class NetworkInstance;
+    friend class Peer;
+public:
+    static constexpr const size_t default_high_watermark = 4 * 1024 * 1024;
+    static constexpr const size_t default_low_watermark = 1024 * 1024;
 public:
     bool init(Script *script, ptr<TimerManager> timermgr, ptr<Reactor> reactor) noexcept;
     const std::vector<ptr<NetworkNode>> &nodes() const noexcept {
@@ -164,13 +258,43 @@ public:
     unsigned call_count() const noexcept {
         return _call_count;
     }
+    bool reuse_port() const noexcept {
+        return _reuse_port;
+    }
+    void reuse_port(bool value) noexcept {
+        _reuse_port = value;
+    }
+    void watermark(size_t high, size_t low) noexcept {
+        _high_watermark = high;
+        _low_watermark = low;
+    }
     bool startup(int type, unsigned id, bool ap = false) noexcept;
     void shutdown_servlets() noexcept;
 	Peer *send(uint64_t id, unsigned servlet, const INotify *req,
                unsigned *seq = nullptr, 
                NetworkInstance *instance = nullptr) noexcept;
     void broadcast(unsigned servlet, const INotify *req) noexcept;
+
+    /* Sends a notify, or hands it straight to the servlet when the target
+     * instance is this process. req is copied either way, the caller keeps
+     * it.
+     */
+    bool post(uint64_t id, unsigned servlet, const INotify *req, NetworkInstance *instance = nullptr) noexcept;
     void call(uint64_t id, unsigned servlet, IRequest *req, IResponse *rsp, NetworkInstance *instance = nullptr);
+
+    /* The two halves of call() for callers that wait some other way.
+     * call_start sends call on behalf of ctx and returns whether ctx has to
+     * wait for it, ctx is woken once call->result is known. call_finish
+     * cleans up and throws as call() does unless the call succeeded.
+     */
+    bool call_start(Context *ctx, Call *call);
+    void call_finish(Context *ctx, Call *call, bool waited, bool resumed = true);
+
+    /* Sends every call at once and yields until wait of them (all when 0)
+     * have finished or the rpc timeout expires. Returns the number of calls
+     * whose result is GX_CALL_OK.
+     */
+    unsigned call_all(Call *calls, unsigned count, unsigned wait = 0);
     bool ready() noexcept;
 
     template <typename _Message>
@@ -194,7 +318,7 @@ public:
         bool>::type
     call(_Message &msg, NetworkInstance *instance = nullptr) {
         assert(msg.req->id());
-        return send(msg.req->id(), _Message::the_message_id, msg.req, nullptr, instance);
+        return post(msg.req->id(), _Message::the_message_id, msg.req, instance);
     }
 
     template <typename _Message>
@@ -203,9 +327,18 @@ public:
     }
 
     template <typename _Message>
-    void send(_Message &msg) {
+    typename std::enable_if<
+        !std::is_void<typename _Message::response_type>::value>::type
+    send(_Message &msg) {
+        /* the reply is dropped, the servlet still answers over the socket */
         send(msg.req->id(), _Message::the_message_id, msg.req);
     }
+    template <typename _Message>
+    typename std::enable_if<
+        std::is_void<typename _Message::response_type>::value>::type
+    send(_Message &msg) {
+        post(msg.req->id(), _Message::the_message_id, msg.req);
+    }
 
     static unsigned lb_value(uint64_t id) noexcept {
         return hash_iterative(&id, sizeof(id));
@@ -252,12 +385,15 @@ private:
     std::vector<ptr<NetworkNode>> _nodes;
     std::vector<ptr<NetworkInstance>> _instances;
     NetworkServlets _servlets;
-    std::unordered_map<unsigned, Context*> _call_map;
+    CallTable _calls;
     ptr<TimerManager> _timermgr;
     ptr<Reactor> _reactor;
     gx_list(Peer, _entry) _connect_list;
     gx_list(Peer, _entry) _accept_list;
     unsigned _call_count;
+    bool _reuse_port;
+    size_t _high_watermark;
+    size_t _low_watermark;
 };
 
 GX_NS_END
@@ -21,6 +21,7 @@ template <typename> class weak_ptr;
 class Object {
     template <typename> friend class object;
     template <typename> friend class ptr;
+    friend class PageAllocator;
 public:
     typedef size_t count_type;
 
@@ -3,11 +3,15 @@
 #include "log.h"
 
 #include <cstdlib>
+#include <cstdio>
 #ifndef GX_PLATFORM_WIN32
 #include <sys/mman.h>
 #include <unistd.h>
 #endif
 #include <cassert>
+#if GX_MT
+#include <vector>
+#endif
 
 GX_NS_BEGIN
 
@@ -31,25 +35,94 @@ static void __free(void *p, size_t size) noexcept {
 #endif
 }
 
+/* a 2 MB aligned mapping, so that it can be made of huge pages, `mode`
+ * drops to huge_advise when the reserved pool is empty
+ */
+static void *__alloc_huge(size_t size, unsigned &mode) noexcept {
+#ifndef GX_PLATFORM_WIN32
+    char *p;
+#ifdef MAP_HUGETLB
+    if (mode == PageAllocator::huge_reserved) {
+        p = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+        mode = PageAllocator::huge_advise;
+    }
+#endif
+    p = (char*)__alloc(size + PageAllocator::huge_page_size);
+    if (!p) {
+        return nullptr;
+    }
+    char *q = (char*)gx_align((uintptr_t)p, (uintptr_t)PageAllocator::huge_page_size);
+    if (q != p) {
+        munmap(p, q - p);
+    }
+    munmap(q + size, PageAllocator::huge_page_size - (q - p));
+#ifdef MADV_HUGEPAGE
+    madvise(q, size, MADV_HUGEPAGE);
+#endif
+    return q;
+#else
+    return __alloc(size);
+#endif
+}
+
+/* gives the pages back, the range stays mapped. The contents are undefined
+ * when reused: zero after MADV_DONTNEED, maybe the old data under MADV_FREE.
+ */
+static bool __trim(void *p, size_t size) noexcept {
+#ifdef GX_PLATFORM_WIN32
+    return false;
+#else
+#ifdef MADV_FREE
+    if (!madvise(p, size, MADV_FREE)) {
+        return true;
+    }
+#endif
+    return !madvise(p, size, MADV_DONTNEED);
+#endif
+}
+
+thread_local PageAllocator *PageAllocator::_local;
+unsigned PageAllocator::_huge_pages;
+
 PageAllocator::PageAllocator() noexcept
-: _iseg(), _cseg()
+: _iseg(), _cseg(), _idle_timeout(default_idle_timeout),
+  _iseg_size(iseg_initsize), _cseg_size(cseg_initsize),
+  _large_count(), _large_bytes(), _allocs(), _frees(),
+  _dump_allocs(), _dump_frees(), _dump_time(monotime())
+#if GX_MT
+  , _owned(), _remote(), _remote_count()
+#endif
 { }
 
 PageAllocator::~PageAllocator() noexcept {
     segment  *seg;
+    /* their headers are in the segments below */
+    while ((seg = _chunk_segments.pop_front())) {
+        segment_destroy(seg);
+    }
     while ((seg = _segments.pop_front())) {
         segment_destroy(seg);
     }
 }
 
-PageAllocator::segment *PageAllocator::segment_create(PageAllocator::segment *seg, unsigned size) noexcept {
+PageAllocator::segment *PageAllocator::segment_create(PageAllocator::segment *seg, unsigned size, unsigned huge) noexcept {
     assert(size);
     if (!seg) {
         size += sizeof(segment);
     }
-    size = gx_align(size, sys_page_size);
 
-    char *p = (char*)__alloc(size);
+    char *p;
+    if (huge != huge_none) {
+        size = gx_align(size, huge_page_size);
+        p = (char*)__alloc_huge(size, huge);
+    }
+    else {
+        size = gx_align(size, sys_page_size);
+        p = (char*)__alloc(size);
+    }
     if (!p) {
         return nullptr;
     }
@@ -63,7 +136,9 @@ PageAllocator::segment *PageAllocator::segment_create(PageAllocator::segment *se
     }
     seg->_base = p;
     seg->_endp = p + size;
-    _segments.push_front(seg);
+    seg->_free = 0;
+    seg->_idle = 0;
+    seg->_huge = huge;
     return seg;
 }
 
@@ -71,37 +146,23 @@ void PageAllocator::segment_destroy(PageAllocator::segment *seg) noexcept {
     __free(seg->_base, seg->_endp - seg->_base);
 }
 
-bool PageAllocator::segment_expand(PageAllocator::segment *seg, unsigned size) noexcept {
-#ifdef GX_PLATFORM_WIN32
-	return false;
-#else
-    unsigned old_size = seg->_endp - seg->_base;
-    unsigned new_size = old_size + gx_align(size, sys_page_size);
-
-    char *p = (char *)mremap(seg->_base, old_size, new_size, 0);
-    if (p == MAP_FAILED) {
-        return false;
-    }
-    assert(p == seg->_base);
-    seg->_endp = p + new_size;
-    return true;
-#endif
-}
-
 inline void *PageAllocator::ialloc(unsigned size) noexcept {
     char *p;
     size = gx_align_default(size);
 
     while (1) {
         if (!_iseg) {
-            _iseg = segment_create(nullptr, size < iseg_initsize ? iseg_initsize : size);
+            _iseg = segment_create(nullptr, size < _iseg_size ? _iseg_size : size);
+            _segments.push_front(_iseg);
+            /* each one twice the last, the tail of a full one is left */
+            if (_iseg_size < iseg_max_size) {
+                _iseg_size <<= 1;
+            }
         }
 
         if (gx_unlikely(_iseg->_firstp + size > _iseg->_endp)) {
-            if (!segment_expand(_iseg, iseg_expand_size)) {
-                _iseg = nullptr;
-                continue;
-            }
+            _iseg = nullptr;
+            continue;
         }
 
         p = _iseg->_firstp;
@@ -142,22 +203,39 @@ inline void PageAllocator::page_free(Page *pg) noexcept {
 }
 
 inline void *PageAllocator::chunk_alloc() noexcept {
-    void *p = (void *)_freetab->pop_front();
-    if (p) {
+    void *p;
+    /* the most recently freed first, the trimmed ones fault in again */
+    chunk *c = _chunks.pop_front();
+    if (!c && (c = _trimmed.pop_front())) {
+        c->_seg->_idle--;
+    }
+    if (c) {
+        p = c->_base;
+        c->_seg->_free--;
+        _spare_chunks.push_front(c);
         return p;
     }
 
     while (1) {
         if (!_cseg) {
-            _cseg = (segment *)ialloc(sizeof(segment));
-            segment_create(_cseg, cseg_initsize);
+            segment *seg = _spare_segments.pop_front();
+            if (!seg) {
+                seg = (segment *)ialloc(sizeof(segment));
+            }
+            if (!segment_create(seg, _cseg_size, _huge_pages)) {
+                _spare_segments.push_front(seg);
+                return nullptr;
+            }
+            _chunk_segments.push_front(seg);
+            _cseg = seg;
+            if (_cseg_size < cseg_max_size) {
+                _cseg_size <<= 1;
+            }
         }
 
         if (gx_unlikely(_cseg->_firstp + page_max_size > _cseg->_endp)) {
-            if (!segment_expand(_cseg, cseg_expand_size)) {
-                _cseg = nullptr;
-                continue;
-            }
+            _cseg = nullptr;
+            continue;
         }
 
         p = _cseg->_firstp;
@@ -166,8 +244,98 @@ inline void *PageAllocator::chunk_alloc() noexcept {
     }
 }
 
-inline void PageAllocator::chunk_free(void *chunk) noexcept {
-    _freetab->push_front((page_node *)chunk);
+PageAllocator::segment *PageAllocator::chunk_segment(void *p) noexcept {
+    for (segment *seg : _chunk_segments) {
+        if ((char *)p >= seg->_base && (char *)p < seg->_endp) {
+            return seg;
+        }
+    }
+    assert(0);
+    return nullptr;
+}
+
+inline void PageAllocator::chunk_free(void *p) noexcept {
+    chunk *c = _spare_chunks.pop_front();
+    if (!c) {
+        c = (chunk *)ialloc(sizeof(chunk));
+    }
+    c->_base = (char *)p;
+    c->_seg = chunk_segment(p);
+    c->_seg->_free++;
+    c->_time = monotime();
+    _chunks.push_front(c);
+}
+
+/* the segment has every chunk carved from it idle on `chunks`, and is
+ * not the one still being carved */
+void PageAllocator::segment_release(segment *seg, gx_list(chunk, _entry) &chunks) noexcept {
+    assert(seg != _cseg);
+    for (auto it = chunks.begin(); it != chunks.end();) {
+        chunk *c = *it++;
+        if (c->_seg == seg) {
+            gx_list(chunk, _entry)::remove(c);
+            _spare_chunks.push_front(c);
+        }
+    }
+    gx_list(segment, _entry)::remove(seg);
+    segment_destroy(seg);
+    _spare_segments.push_front(seg);
+}
+
+size_t PageAllocator::trim() noexcept {
+#if GX_MT
+    drain();
+#endif
+    size_t bytes = 0;
+    timeval_t now = monotime();
+    chunk *c;
+
+    /* the free list is ordered by free time, the oldest at the back */
+    gx_list(chunk, _entry) kept;
+    while ((c = _chunks.back()) && now - c->_time >= _idle_timeout) {
+        gx_list(chunk, _entry)::remove(c);
+        /* MAP_HUGETLB pages can't be given back a chunk at a time */
+        if (c->_seg->_huge == huge_reserved || !__trim(c->_base, page_max_size)) {
+            kept.push_front(c);
+            continue;
+        }
+        bytes += page_max_size;
+        c->_seg->_idle++;
+        _trimmed.push_front(c);
+    }
+
+    for (auto it = _chunk_segments.begin(); it != _chunk_segments.end();) {
+        segment *seg = *it++;
+        /* chunk_alloc() carves the next chunks from the rest of it */
+        if (seg == _cseg) {
+            continue;
+        }
+        size_t carved = seg->_firstp - seg->_base;
+        if (seg->_huge == huge_reserved) {
+            /* unmapped whole, once every chunk carved from it is idle */
+            size_t idle = 0;
+            for (chunk *k : kept) {
+                if (k->_seg == seg) {
+                    idle++;
+                }
+            }
+            if (idle && idle * page_max_size == carved) {
+                bytes += seg->_endp - seg->_base;
+                segment_release(seg, kept);
+            }
+        }
+        else if (seg->_idle && seg->_idle * page_max_size == carved) {
+            /* the part never carved was never touched either */
+            bytes += seg->_endp - seg->_firstp;
+            segment_release(seg, _trimmed);
+        }
+    }
+
+    /* still resident, back on the free list in free time order */
+    while ((c = kept.pop_front())) {
+        _chunks.push_back(c);
+    }
+    return bytes;
 }
 
 Page *PageAllocator::alloc(size_t size) noexcept {
@@ -175,7 +343,13 @@ Page *PageAllocator::alloc(size_t size) noexcept {
     page_node *node, *buddy;
     area *a;
 
+#if GX_MT
+    if (gx_unlikely(_remote_count.load(std::memory_order_relaxed))) {
+        drain();
+    }
+#endif
     Page *pg = page_alloc();
+    _allocs++;
 
     size = gx_align(size, page_min_size);
 
@@ -230,6 +404,8 @@ buddy_final:
         return pg;
     } else {
         pg->base = __alloc(size);
+        _large_count++;
+        _large_bytes += size;
         pg->order_size = size;
         pg->firstp = (char *)pg->base;
         pg->endp = pg->firstp + size;
@@ -237,7 +413,33 @@ buddy_final:
     }
 }
 
+/* a read-only page over memory kept alive by owner, size is 0 */
+Page *PageAllocator::share(char *firstp, char *endp, const Object *owner) noexcept {
+    Page *pg = page_alloc();
+    _allocs++;
+    owner->retain();
+    pg->base = (void*)owner;
+    pg->order_size = 0;
+    pg->size = 0;
+    pg->firstp = firstp;
+    pg->p = pg->endp = endp;
+    return pg;
+}
+
 void PageAllocator::free(Page *pg) noexcept {
+#if GX_MT
+    if (gx_unlikely(_local != this && _owned)) {
+        remote_free(pg);
+        return;
+    }
+#endif
+    _frees++;
+    if (gx_unlikely(!pg->order_size)) {
+        const Object *owner = (const Object*)pg->base;
+        page_free(pg);
+        owner->release();
+        return;
+    }
     if (gx_likely(pg->order_size < max_order)) {
         page_node *node = (page_node *)pg->base;
         page_node *buddy;
@@ -274,9 +476,161 @@ void PageAllocator::free(Page *pg) noexcept {
         chunk_free(pg->base);
     } else {
         __free(pg->base, pg->order_size);
+        _large_count--;
+        _large_bytes -= pg->order_size;
     }
     page_free(pg);
 }
 
+void PageAllocator::stats(stats_type &st) noexcept {
+#if GX_MT
+    drain();
+#endif
+    st = stats_type();
+    for (unsigned order = min_order; order < max_order; ++order) {
+        size_t n = 0;
+        for (auto it = _freetab[order].begin(); it != _freetab[order].end(); ++it) {
+            n++;
+        }
+        st.free_bytes[order] = n << (page_boundary_index + order);
+    }
+    for (segment *seg : _chunk_segments) {
+        st.chunks_used += (seg->_firstp - seg->_base) / page_max_size - seg->_free;
+        st.chunks_free += seg->_free - seg->_idle;
+        st.chunks_trimmed += seg->_idle;
+        st.segments++;
+        st.mapped_bytes += seg->_endp - seg->_base;
+    }
+    for (segment *seg : _segments) {
+        st.segments++;
+        st.mapped_bytes += seg->_endp - seg->_base;
+    }
+    st.large_count = _large_count;
+    st.large_bytes = _large_bytes;
+    st.pages = _allocs - _frees;
+    st.allocs = _allocs;
+    st.frees = _frees;
+}
+
+void PageAllocator::dump() noexcept {
+    stats_type st;
+    stats(st);
+
+    timeval_t now = monotime();
+    double secs = now > _dump_time ? (now - _dump_time) / 1000.0 : 1.0;
+    double alloc_rate = (st.allocs - _dump_allocs) / secs;
+    double free_rate = (st.frees - _dump_frees) / secs;
+    _dump_allocs = st.allocs;
+    _dump_frees = st.frees;
+    _dump_time = now;
+
+    char buf[256];
+    int n = 0;
+    for (unsigned order = min_order; order < max_order; ++order) {
+        n += snprintf(buf + n, sizeof(buf) - n, " %uK:%zu",
+            1u << (page_boundary_index + order - 10), st.free_bytes[order]);
+    }
+    log_info("pages: %zu in use, %.1f allocs/s, %.1f frees/s, free by size%s.",
+        st.pages, alloc_rate, free_rate, buf);
+    log_info("chunks: %zu used, %zu free, %zu trimmed, large: %zu (%zu bytes), segments: %zu (%zu bytes mapped).",
+        st.chunks_used, st.chunks_free, st.chunks_trimmed,
+        st.large_count, st.large_bytes, st.segments, st.mapped_bytes);
+}
+
+#if GX_MT
+/* the allocator a thread adopted and its batch of pages freed for another */
+struct PageAllocator::thread_cache {
+    PageAllocator *adopted;
+    PageAllocator *pa;
+    Page *pages;
+    Page *last;
+    size_t count;
+
+    ~thread_cache() noexcept;
+};
+
+static std::mutex __adopt_mutex;
+static std::vector<ptr<PageAllocator>> __allocators;
+static std::vector<PageAllocator*> __spare;
+thread_local PageAllocator::thread_cache PageAllocator::_cache;
+
+PageAllocator::thread_cache::~thread_cache() noexcept {
+    PageAllocator::flush();
+    if (adopted) {
+        if (_local == adopted) {
+            _local = nullptr;
+        }
+        /* pages of it may still be around, the next thread takes it over */
+        std::lock_guard<std::mutex> lock(__adopt_mutex);
+        __spare.push_back(adopted);
+    }
+}
+
+PageAllocator *PageAllocator::adopt() noexcept {
+    PageAllocator *pa;
+    {
+        std::lock_guard<std::mutex> lock(__adopt_mutex);
+        if (!__spare.empty()) {
+            pa = __spare.back();
+            __spare.pop_back();
+        }
+        else {
+            object<PageAllocator> obj;
+            __allocators.push_back(obj);
+            pa = obj;
+        }
+    }
+    _cache.adopted = pa;
+    local(pa);
+    return pa;
+}
+
+void PageAllocator::remote_free(Page *pg) noexcept {
+    thread_cache &tc = _cache;
+    if (tc.pa != this) {
+        flush();
+        tc.pa = this;
+        tc.last = pg;
+    }
+    pg->next = tc.pages;
+    tc.pages = pg;
+    if (++tc.count >= remote_batch_size) {
+        flush();
+    }
+}
+
+void PageAllocator::flush() noexcept {
+    thread_cache &tc = _cache;
+    if (!tc.count) {
+        return;
+    }
+    PageAllocator *pa = tc.pa;
+    {
+        std::lock_guard<std::mutex> lock(pa->_remote_mutex);
+        tc.last->next = pa->_remote;
+        pa->_remote = tc.pages;
+        pa->_remote_count.store(pa->_remote_count.load(std::memory_order_relaxed) + tc.count, std::memory_order_relaxed);
+    }
+    tc.pa = nullptr;
+    tc.pages = tc.last = nullptr;
+    tc.count = 0;
+}
+
+void PageAllocator::drain() noexcept {
+    Page *pg;
+    {
+        std::lock_guard<std::mutex> lock(_remote_mutex);
+        pg = _remote;
+        _remote = nullptr;
+        _remote_count.store(0, std::memory_order_relaxed);
+    }
+    while (pg) {
+        Page *next = pg->next;
+        free(pg);
+        pg = next;
+    }
+}
+#endif
+
 GX_NS_END
 
@@ -4,6 +4,12 @@
 #include "platform.h"
 #include "list.h"
 #include "singleton.h"
+#include "timeval.h"
+
+#if GX_MT
+#include <atomic>
+#include <mutex>
+#endif
 
 GX_NS_BEGIN
 
@@ -41,6 +47,9 @@ private:
         char *_base;
         char *_firstp;
         char *_endp;
+        size_t _free;   /* chunks of it on the free lists */
+        size_t _idle;   /* of which given back to the system */
+        unsigned _huge; /* how it is backed, see huge_pages() */
     };
 
 public:
@@ -52,9 +61,13 @@ public:
     static constexpr const unsigned page_min_size = 1 << (page_boundary_index + min_order);
     static constexpr const unsigned page_max_size = 1 << (page_boundary_index + max_order);
     static constexpr const unsigned iseg_initsize = (1024 * 64 - sizeof(segment));
-    static constexpr const unsigned iseg_expand_size = 1024 * 64;
+    static constexpr const unsigned iseg_max_size = 1024 * 1024;
     static constexpr const unsigned cseg_initsize = page_max_size * 16;
-    static constexpr const unsigned cseg_expand_size = page_max_size * 16;
+    static constexpr const unsigned cseg_max_size = page_max_size * 256;
+    static constexpr const unsigned huge_page_size = 1024 * 1024 * 2;
+    static constexpr const unsigned remote_batch_size = 32;
+    static constexpr const timeval_t default_idle_timeout = 30 * 1000;
+    static constexpr const timeval_t default_trim_interval = 10 * 1000;
 
 private:
     struct page_node {
@@ -70,17 +83,117 @@ private:
             slist_entry _entry;
         };
     };
+    /* a free max order chunk, kept apart so that the memory can go back */
+    struct chunk {
+        clist_entry _entry;
+        char *_base;
+        segment *_seg;
+        timeval_t _time;
+    };
+#if GX_MT
+    struct thread_cache;
+#endif
+
+public:
+    /* backing of the chunk segments, see huge_pages() */
+    enum {
+        huge_none,
+        huge_advise,    /* transparent huge pages, madvise(MADV_HUGEPAGE) */
+        huge_reserved,  /* MAP_HUGETLB from the reserved pool, else huge_advise */
+    };
+
+    /* where the memory is, see stats() */
+    struct stats_type {
+        size_t free_bytes[max_order];   /* free buddy pages by order */
+        size_t chunks_used;             /* including the ones split up */
+        size_t chunks_free;
+        size_t chunks_trimmed;
+        size_t large_count;             /* pages over page_max_size */
+        size_t large_bytes;
+        size_t segments;
+        size_t mapped_bytes;
+        size_t pages;                   /* Page outstanding */
+        uint64_t allocs;
+        uint64_t frees;
+    };
 
 public:
     PageAllocator() noexcept;
     ~PageAllocator() noexcept;
+
+    /* Threads
+     * With GX_MT every thread gets an allocator of its own on the first
+     * instance(), adopted back from exited threads when there are any.
+     * Pages freed on a thread other than the owner's are batched and handed
+     * back under a lock, the owner frees them on its next alloc(). flush()
+     * hands over the batch of the calling thread, loops call it each turn.
+     * An allocator no thread ever took as its own is private to whoever
+     * created it, which serializes its use, and frees locally.
+     */
+    static PageAllocator *instance() noexcept {
+        PageAllocator *pa = _local;
+        if (gx_likely(!pa)) {
+#if GX_MT
+            return adopt();
+#else
+            return singleton<PageAllocator>::instance();
+#endif
+        }
+        return pa;
+    }
+#if GX_MT
+    static void flush() noexcept;
+#else
+    static void flush() noexcept { }
+#endif
+    static void local(PageAllocator *pa) noexcept {
+#if GX_MT
+        if (pa) {
+            pa->_owned = true;
+        }
+#endif
+        _local = pa;
+    }
     Page *alloc(std::size_t size = 1) noexcept;
+    Page *share(char *firstp, char *endp, const Object *owner) noexcept;
     void free(Page *p) noexcept;
 
+    /* Trimming
+     * trim() gives back to the system the chunks free for longer than
+     * idle_timeout, and unmaps the chunk segments nothing is carved from
+     * any more. It returns the bytes given back, call it periodically.
+     */
+    size_t trim() noexcept;
+    void idle_timeout(timeval_t value) noexcept {
+        _idle_timeout = value;
+    }
+    timeval_t idle_timeout() const noexcept {
+        return _idle_timeout;
+    }
+
+    /* Statistics
+     * stats() takes a snapshot, walking the free lists. dump() logs one
+     * together with the alloc and free rates since the last dump, call it
+     * periodically.
+     */
+    void stats(stats_type &st) noexcept;
+    void dump() noexcept;
+
+    /* Huge pages
+     * Chunk segments mapped from now on are 2 MB aligned and backed by huge
+     * pages as the mode says, quietly falling back to normal pages when the
+     * system has none to give. It applies to every allocator.
+     */
+    static void huge_pages(unsigned mode) noexcept {
+        _huge_pages = mode;
+    }
+    static unsigned huge_pages() noexcept {
+        return _huge_pages;
+    }
+
 private:
-    segment *segment_create(segment *seg, unsigned size) noexcept;
+    segment *segment_create(segment *seg, unsigned size, unsigned huge = huge_none) noexcept;
     void segment_destroy(segment *seg) noexcept;
-    bool segment_expand(segment *seg, unsigned size) noexcept;
 
     void *ialloc(unsigned size) noexcept;
 
@@ -89,7 +202,14 @@ private:
     area *area_alloc(void *base) noexcept;
     void area_free(area *a) noexcept;
     void *chunk_alloc() noexcept;
-    void chunk_free(void *chunk) noexcept;
+    void chunk_free(void *p) noexcept;
+    segment *chunk_segment(void *p) noexcept;
+    void segment_release(segment *seg, gx_list(chunk, _entry) &chunks) noexcept;
+#if GX_MT
+    static PageAllocator *adopt() noexcept;
+    void remote_free(Page *pg) noexcept;
+    void drain() noexcept;
+#endif
 
 private:
     gx_list(page_node, _entry) _freetab[max_order];
@@ -98,6 +218,32 @@ private:
     gx_list(Page, sentry) _pages;
     gx_list(area, _entry) _areas;
     gx_list(segment, _entry) _segments;
+    gx_list(segment, _entry) _chunk_segments;
+    gx_list(segment, _entry) _spare_segments;
+    gx_list(chunk, _entry) _chunks;
+    gx_list(chunk, _entry) _trimmed;
+    gx_list(chunk, _entry) _spare_chunks;
+    timeval_t _idle_timeout;
+    unsigned _iseg_size;
+    unsigned _cseg_size;
+    size_t _large_count;
+    size_t _large_bytes;
+    uint64_t _allocs;
+    uint64_t _frees;
+    uint64_t _dump_allocs;
+    uint64_t _dump_frees;
+    timeval_t _dump_time;
+#if GX_MT
+    bool _owned;
+    std::mutex _remote_mutex;
+    Page *_remote;
+    std::atomic<size_t> _remote_count;
+#endif
+    static thread_local PageAllocator *_local;
+#if GX_MT
+    static thread_local thread_cache _cache;
+#endif
+    static unsigned _huge_pages;
 };
 
 GX_NS_END
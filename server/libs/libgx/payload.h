@@ -0,0 +1,36 @@
+#ifndef __GX_PAYLOAD_H__
+#define __GX_PAYLOAD_H__
+
+#include "platform.h"
+#include "object.h"
+#include "page.h"
+#include "stream.h"
+
+GX_NS_BEGIN
+
+/* Payload
+ * A message serialized once and linked into many output streams without
+ * copying, see Stream::link. It must not be written after the first link.
+ */
+class Payload : public Object {
+public:
+    Payload(PageAllocator *pa = nullptr) noexcept : _stream(pa)
+    { }
+
+    Stream &stream() noexcept {
+        return _stream;
+    }
+    const Stream &stream() const noexcept {
+        return _stream;
+    }
+    std::size_t size() const noexcept {
+        return _stream.size();
+    }
+private:
+    Stream _stream;
+};
+
+GX_NS_END
+
+#endif
+
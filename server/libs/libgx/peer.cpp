@@ -8,10 +8,10 @@
 
 GX_NS_BEGIN
 
-Peer::Peer() noexcept : _is_ap(false), peer_object()
+Peer::Peer() noexcept : _network(), _is_ap(false), peer_object()
 { }
 
-Peer::Peer(bool is_ap) noexcept : _is_ap(is_ap), peer_object()
+Peer::Peer(bool is_ap) noexcept : _network(), _is_ap(is_ap), peer_object()
 { }
 
 Peer::~Peer() noexcept {
@@ -19,10 +19,15 @@ Peer::~Peer() noexcept {
         peer_object->on_peer_close();
         peer_object = nullptr;
     }
-    Context *ctx;
-    while ((ctx = _call_list.front())) {
-        log_debug("peer close cancal call");
-        ctx->call_timedout();
+    Call *call;
+    while ((call = _call_list.front())) {
+        call_list_t::remove(call);
+        /* a stale seq would keep its slot and make the table grow */
+        if (_network) {
+            _network->_calls.remove(call->seq);
+        }
+        call->result = GX_CALL_CANCEL;
+        call->ctx->call_done();
     }
 
     gx_list(Peer, _entry)::remove(this);
@@ -61,6 +66,18 @@ bool Peer::send(const Stream &stream) noexcept {
     return true;
 }
 
+bool Peer::send(const Payload *payload) noexcept {
+    _socket->output().link(payload);
+    _socket->send();
+    return true;
+}
+
+void Peer::on_congested(bool congested) noexcept {
+    if (peer_object) {
+        peer_object->on_peer_congested(congested);
+    }
+}
+
 bool Peer::shutdown(bool read, bool write) noexcept {
     _socket->shutdown(read, write);
     return true;
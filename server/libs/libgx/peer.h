@@ -4,6 +4,7 @@
 #include "object.h"
 #include "memory.h"
 #include "stream.h"
+#include "payload.h"
 #include "serial.h"
 #include "protocol.h"
 #include "socket.h"
@@ -19,6 +20,7 @@ struct PeerObject {
     friend class Peer;
 protected:
     virtual void on_peer_close() = 0;
+    virtual void on_peer_congested(bool congested) { }
 };
 
 class Peer : public WeakableObject {
@@ -46,17 +48,23 @@ public:
     bool is_ap() const noexcept {
         return _is_ap;
     }
+    bool congested() const noexcept {
+        return _socket && _socket->congested();
+    }
     bool send(unsigned servlet_id, unsigned seq, const IResponse *rsp) noexcept;
     bool send(unsigned servlet_id, unsigned seq, const INotify *req) noexcept;
     bool send(unsigned servlet_id, const INotify *req) noexcept {
         return send(servlet_id, 0, req);
     }
     bool send(const Stream &stream) noexcept;
+    bool send(const Payload *payload) noexcept;
     bool shutdown(bool read, bool write) noexcept;
 private:
-    typedef gx_list(Context, _entry) ctx_list_t;
+    void on_congested(bool congested) noexcept;
+private:
+    typedef gx_list(Call, _entry) call_list_t;
 private:
-    ctx_list_t _call_list;
+    call_list_t _call_list;
     weak_ptr<Socket> _socket;
     Network *_network;
     Protocol _protocol;
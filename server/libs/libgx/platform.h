@@ -21,6 +21,18 @@
 #else
     #define GX_PLATFORM_LINUX
     #define GX_REACTOR_USE_EPOLL
+    #if defined(__has_include)
+        #if __has_include(<linux/io_uring.h>)
+            #define GX_REACTOR_USE_URING
+        #endif
+    #endif
+    #define GX_NETWORK_USE_SHM
+#endif
+
+#if __cplusplus >= 202002L && defined(__has_include)
+    #if __has_include(<coroutine>)
+        #define GX_USE_CO_AWAIT
+    #endif
 #endif
 
 #include <cstddef>
@@ -1,9 +1,12 @@
 #include "reactor.h"
 #include "log.h"
+#include "rc.h"
 
 #include <time.h>
+#include <cstdlib>
 #ifdef GX_PLATFORM_LINUX
 #include <sys/epoll.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <errno.h>
 #include <netinet/tcp.h>
@@ -16,10 +19,21 @@ GX_NS_BEGIN
 
 /* Reactor */
 Reactor::Reactor(ptr<TimerManager> timermgr, unsigned maxfds, unsigned maxevents) noexcept
-: _maxfds(maxfds), _maxevents(maxevents), _timermgr(timermgr)
+: _maxfds(maxfds), _maxevents(maxevents), _timermgr(timermgr),
+  _flush_bytes(), _flush_delay(), _flush_time()
 {
 #if defined(GX_REACTOR_USE_EPOLL)
 	_fds.resize(maxfds);
+#ifdef GX_REACTOR_USE_URING
+    _cqes = nullptr;
+    const char *backend = std::getenv("GX_REACTOR");
+    if (backend && !strcmp(backend, "uring") && _uring.init(_maxevents * 4)) {
+        _fd = GX_FD_INVALID_VALUE;
+        _events = nullptr;
+        _cqes = (URing::cqe_type *)std::malloc(sizeof(URing::cqe_type) * _maxevents);
+        return;
+    }
+#endif
     _events = (struct ::epoll_event *)std::malloc(sizeof(struct ::epoll_event) * _maxevents);
     if ((_fd = epoll_create(maxfds)) < 0) {
         log_die("epoll create failed");
@@ -36,6 +50,11 @@ Reactor::~Reactor() noexcept {
     if (_events) {
         std::free(_events);
     }
+#ifdef GX_REACTOR_USE_URING
+    if (_cqes) {
+        std::free(_cqes);
+    }
+#endif
 #elif defined(GX_REACTOR_USE_SELECT)
 #endif
 }
@@ -43,6 +62,19 @@ Reactor::~Reactor() noexcept {
 void Reactor::push() noexcept {
     weak_ptr<Socket> socket;
     while ((socket = _send_list.pop_front())) {
+#ifdef GX_REACTOR_USE_URING
+        if (socket->direct()) {
+            _sock_list.push_front(socket);
+            if (!watermark(socket)) {
+                if (socket) {
+                    close(socket->fd());
+                }
+                continue;
+            }
+            uring_send_add(socket);
+            continue;
+        }
+#endif
         if (socket->push() < 0) {
             if (!socket->_handler(*socket, poll_err)) {
                 if (socket) {
@@ -52,6 +84,12 @@ void Reactor::push() noexcept {
             }
         }
         _sock_list.push_front(socket);
+        if (!watermark(socket)) {
+            if (socket) {
+                close(socket->fd());
+            }
+            continue;
+        }
 		if (socket->_output.size()) {
 #ifdef GX_REACTOR_USE_SELECT
 			socket->flags(socket->flags() | poll_out);
@@ -72,13 +110,55 @@ void Reactor::push() noexcept {
     }
 }
 
+bool Reactor::watermark(Socket *socket) noexcept {
+    size_t size = socket->_output.size();
+    unsigned flags;
+    if (!socket->_congested) {
+        if (!socket->_high_watermark || size < socket->_high_watermark) {
+            return true;
+        }
+        socket->_congested = true;
+        flags = poll_high;
+    }
+    else {
+        if (size > socket->_low_watermark) {
+            return true;
+        }
+        socket->_congested = false;
+        flags = poll_low;
+    }
+    return socket->_handler(*socket, flags);
+}
+
 void Reactor::send(Socket *socket) {
     if (socket->_reactor == this) {
+        if (_send_list.empty()) {
+            _flush_time = monotime() + _flush_delay;
+        }
         SocketList::remove(socket);
         _send_list.push_front(socket);
     }
 }
 
+void Reactor::flush(bool force) noexcept {
+    if (_send_list.empty()) {
+        return;
+    }
+    if (!force && _flush_delay && monotime() < _flush_time) {
+        size_t size = 0;
+        for (Socket *socket = _send_list.front(); socket; socket = SocketList::next(socket)) {
+            size += socket->_output.size();
+            if (size >= _flush_bytes) {
+                break;
+            }
+        }
+        if (size < _flush_bytes) {
+            return;
+        }
+    }
+    push();
+}
+
 Socket *Reactor::open(int fd, unsigned flags, Socket::handler_type handler, bool et) noexcept {
 #if defined(GX_REACTOR_USE_EPOLL)
     if (!fd_valid(fd) || (unsigned)fd >= maxfds()) {
@@ -92,6 +172,26 @@ Socket *Reactor::open(int fd, unsigned flags, Socket::handler_type handler, bool
 	fd_block(fd, false);
 	fd_nodelay(fd, true);
 
+#ifdef GX_REACTOR_USE_URING
+    if (uring()) {
+        object<Socket> socket;
+        socket->_fd = fd;
+        socket->_handler = handler;
+        socket->_flags = flags;
+        socket->_reactor = this;
+
+        int value = 0;
+        socklen_t len = sizeof(value);
+        if (!getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &value, &len) && value) {
+            socket->_uring_listen = true;
+        }
+        _fds[socket->fd()] = socket;
+        _sock_list.push_front(socket);
+        uring_arm(socket);
+        return socket;
+    }
+#endif
+
     struct epoll_event event;
     event.data.fd = fd;
     event.events = (et ? EPOLLET : 0) | EPOLLHUP | EPOLLRDHUP;
@@ -154,6 +254,13 @@ bool Reactor::on_linger_data(Socket &socket, unsigned flags) noexcept {
         return false;
     }
     if (flags & Reactor::poll_in) {
+        if (socket.direct()) {
+            if (socket.load() < 0) {
+                return false;
+            }
+            socket._input.read(nullptr, socket._input.size());
+            return true;
+        }
         char buf[8192];
         while (1) {
             int n = fd_read(socket.fd(), buf, sizeof(buf));
@@ -197,6 +304,20 @@ void Reactor::close(int fd, timeval_t linger) noexcept {
     }
     if (!linger) {
         socket->_reactor = nullptr;
+#ifdef GX_REACTOR_USE_URING
+        if (uring()) {
+            /* in-flight operations still reference the streams, keep the socket until they finish. */
+            if (socket->_uring_ops) {
+                socket->_uring_hold = _fds[fd];
+                for (unsigned op = uring_poll; op < uring_cancel; ++op) {
+                    if (socket->_uring_ops & (1 << op)) {
+                        uring_cancel_add(socket, op);
+                    }
+                }
+            }
+        }
+        else
+#endif
         epoll_ctl(_fd, EPOLL_CTL_DEL, fd, nullptr);
         socket->_handler(*socket, poll_close);
         SocketList::remove(socket);
@@ -244,6 +365,12 @@ bool Reactor::modify(Socket *socket) noexcept {
     if (socket != _fds[socket->fd()]) {
         return false;
     }
+#ifdef GX_REACTOR_USE_URING
+    if (uring()) {
+        uring_arm(socket);
+        return true;
+    }
+#endif
 
     unsigned flags = socket->flags();
     struct epoll_event event;
@@ -283,26 +410,40 @@ bool Reactor::modify(Socket *socket) noexcept {
 }
 
 int Reactor::loop(timeval_t timeout) {
-    int nfds, flags;
-    weak_ptr<Socket> socket;
+    timeval_t cur = monotime();
 
-    timeval_t cur = adjust_time();
-    if (timeout <= cur) {
-        return 0;
+    /* a timeout already past still polls, without blocking */
+    flush(false);
+    if (timeout > cur && !_send_list.empty() && _flush_time < timeout) {
+        timeout = _flush_time > cur ? _flush_time : cur + 1;
     }
+    int r = poll(timeout > cur ? timeout - cur : 0);
+    flush(false);
+    return r;
+}
+
+int Reactor::poll(timeval_t timeout) {
+    int nfds, flags;
+    weak_ptr<Socket> socket;
 
-	push();
 #if defined(GX_REACTOR_USE_EPOLL)
+#ifdef GX_REACTOR_USE_URING
+    if (uring()) {
+        return uring_loop(timeout);
+    }
+#endif
 	struct epoll_event *event;
 again:
-    nfds = epoll_wait(_fd, _events, _maxevents, timeout - cur);
+    nfds = epoll_wait(_fd, _events, _maxevents, timeout);
     if (gx_unlikely(nfds == -1)) {
         if (gx_likely(errno == EINTR)) {
             goto again;
         }
         return -errno;
-    } else if (gx_likely(nfds > 0)) {
-        adjust_time();
+    }
+    /* the one clock read of the loop iteration */
+    adjust_time();
+    if (gx_likely(nfds > 0)) {
         for (event = _events; nfds--; event++) {
             socket = _fds[event->data.fd].get();
             flags = 0;
@@ -344,10 +485,10 @@ again:
 			FD_SET(socket->fd(), &efds);
 		}
 	}
-	timeval_t d = cur - timeout;
-	tv.tv_sec = (long)(d / 1000);
-	tv.tv_usec = (long)((d % 1000) * 1000);
+	tv.tv_sec = (long)(timeout / 1000);
+	tv.tv_usec = (long)((timeout % 1000) * 1000);
 	nfds = select(0, &rfds, &wfds, &efds, &tv);
+	adjust_time();
 	if (nfds == SOCKET_ERROR) {
 		return -1;
 	}
@@ -377,5 +518,263 @@ again:
 #endif
 }
 
+#ifdef GX_REACTOR_USE_URING
+void Reactor::uring_arm(Socket *socket) noexcept {
+    unsigned flags = socket->_flags;
+    unsigned ops = socket->_uring_ops;
+
+    if (socket->_uring_listen) {
+        if ((flags & poll_in) && !(ops & (1 << uring_accept))) {
+            uring_accept_add(socket);
+        }
+        return;
+    }
+    if (socket->direct()) {
+        if ((ops & (1 << uring_poll)) && socket->_uring_poll) {
+            socket->_uring_poll = 0;
+            uring_cancel_add(socket, uring_poll);
+        }
+        if ((flags & poll_in) && !(ops & (1 << uring_recv)) && !socket->_uring_error) {
+            uring_recv_add(socket);
+        }
+        return;
+    }
+    uring_poll_add(socket);
+}
+
+void Reactor::uring_poll_add(Socket *socket) noexcept {
+    unsigned flags = socket->_flags;
+    unsigned events = 0;
+    if (flags & poll_in) {
+        events |= POLLIN | POLLRDHUP;
+    }
+    if (flags & poll_out) {
+        events |= POLLOUT;
+    }
+    if (flags & poll_err) {
+        events |= POLLERR;
+    }
+
+    URing::sqe_type *sqe;
+    if (socket->_uring_ops & (1 << uring_poll)) {
+        if (events == socket->_uring_poll) {
+            return;
+        }
+        if (!events) {
+            socket->_uring_poll = 0;
+            uring_cancel_add(socket, uring_poll);
+            return;
+        }
+        if (!(sqe = _uring.sqe())) {
+            return;
+        }
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uring_data(socket, uring_poll);
+        sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = events;
+        sqe->user_data = uring_data(socket, uring_cancel);
+        socket->_uring_poll = events;
+        return;
+    }
+    if (!events || !(sqe = _uring.sqe())) {
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = socket->_fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = events;
+    sqe->user_data = uring_data(socket, uring_poll);
+    socket->_uring_poll = events;
+    socket->_uring_ops |= 1 << uring_poll;
+}
+
+void Reactor::uring_recv_add(Socket *socket) noexcept {
+    URing::sqe_type *sqe = _uring.sqe();
+    if (!sqe) {
+        return;
+    }
+    size_t space;
+    char *p = socket->_input.reserve(space);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket->_fd;
+    sqe->addr = (uintptr_t)p;
+    sqe->len = space;
+    sqe->user_data = uring_data(socket, uring_recv);
+    socket->_uring_ops |= 1 << uring_recv;
+}
+
+void Reactor::uring_send_add(Socket *socket) noexcept {
+    if (socket->_uring_ops & (1 << uring_send)) {
+        return;
+    }
+    if (!socket->_output.size()) {
+        if (socket->_timer) {
+            ::shutdown(socket->fd(), SHUT_WR);
+        }
+        return;
+    }
+    URing::sqe_type *sqe = _uring.sqe();
+    if (!sqe) {
+        return;
+    }
+    struct msghdr *msg = &socket->_uring_msg;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = socket->_uring_iov;
+    msg->msg_iovlen = socket->_output.gather(socket->_uring_iov, sizeof(socket->_uring_iov) / sizeof(socket->_uring_iov[0]));
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket->_fd;
+    sqe->addr = (uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uring_data(socket, uring_send);
+    socket->_uring_ops |= 1 << uring_send;
+}
+
+void Reactor::uring_accept_add(Socket *socket) noexcept {
+    URing::sqe_type *sqe = _uring.sqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket->_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_data(socket, uring_accept);
+    socket->_uring_ops |= 1 << uring_accept;
+}
+
+void Reactor::uring_cancel_add(Socket *socket, unsigned op) noexcept {
+    URing::sqe_type *sqe = _uring.sqe();
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_data(socket, op);
+    sqe->user_data = uring_data(socket, uring_cancel);
+}
+
+void Reactor::uring_complete(const URing::cqe_type &cqe) noexcept {
+    unsigned op = cqe.user_data & 7;
+    if (op == uring_cancel) {
+        return;
+    }
+
+    weak_ptr<Socket> socket;
+    socket = (Socket*)(uintptr_t)(cqe.user_data & ~(uint64_t)7);
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    int res = cqe.res;
+    unsigned flags = 0;
+
+    if (socket->_reactor == this) {
+        switch (op) {
+        case uring_poll:
+            if (res < 0) {
+                if (res != -ECANCELED) {
+                    flags = poll_err;
+                }
+                break;
+            }
+            if (res & (POLLIN | POLLRDHUP | POLLHUP)) {
+                flags |= poll_in;
+            }
+            if (res & POLLOUT) {
+                flags |= poll_out;
+            }
+            if (res & POLLERR) {
+                flags |= poll_err;
+            }
+            break;
+        case uring_recv:
+            if (res > 0) {
+                socket->_input.commit(res);
+                flags = poll_in;
+            }
+            else if (res != -ECANCELED) {
+                socket->_uring_error = res ? res : -GX_ECLOSED;
+                flags = poll_in;
+            }
+            break;
+        case uring_send:
+            if (res > 0) {
+                socket->_output.read(nullptr, res);
+                socket->_output.release_shared();
+                if (socket->_congested && socket->_output.size() <= socket->_low_watermark) {
+                    socket->_congested = false;
+                    flags = poll_low;
+                }
+            }
+            else if (res != -ECANCELED) {
+                flags = poll_err;
+            }
+            break;
+        case uring_accept:
+            if (res >= 0) {
+                socket->_uring_accepted = res;
+                flags = poll_in;
+            }
+            else if (res == -EINVAL && !more) {
+                /* multishot accept is not supported, poll the listener instead. */
+                socket->_uring_listen = false;
+            }
+            else if (res != -ECANCELED) {
+                flags = poll_err;
+            }
+            break;
+        }
+
+        if (flags && !socket->_handler(*socket, flags)) {
+            if (socket && socket->_reactor == this) {
+                close(socket->fd());
+            }
+        }
+    }
+    else if (op == uring_accept && res >= 0) {
+        fd_close(res);
+    }
+
+    if (!socket) {
+        return;
+    }
+    if (fd_valid(socket->_uring_accepted)) {
+        fd_close(socket->_uring_accepted);
+        socket->_uring_accepted = GX_FD_INVALID_VALUE;
+    }
+    if (!more) {
+        socket->_uring_ops &= ~(1 << op);
+    }
+    if (socket->_reactor == this) {
+        if (op == uring_send) {
+            uring_send_add(socket);
+        }
+        uring_arm(socket);
+    }
+    else if (!socket->_uring_ops) {
+        ptr<Socket> hold;
+        hold.swap(socket->_uring_hold);
+    }
+}
+
+int Reactor::uring_loop(timeval_t timeout) {
+    int n = _uring.wait(timeout);
+    if (gx_unlikely(n < 0)) {
+        return n;
+    }
+
+    adjust_time();
+
+    unsigned count;
+    while ((count = _uring.peek(_cqes, _maxevents))) {
+        for (unsigned i = 0; i < count; ++i) {
+            uring_complete(_cqes[i]);
+        }
+        if (count < _maxevents) {
+            break;
+        }
+    }
+    return 0;
+}
+#endif
+
 GX_NS_END
 
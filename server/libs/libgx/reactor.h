@@ -7,10 +7,11 @@
 #include "socket.h"
 #include "timeval.h"
 #include "timermanager.h"
+#include "uring.h"
 
 struct epoll_event;
-#ifdef GX_PLATFORM_LINUX
-#include <sys/select.h>
+#ifdef GX_PLATFORM_LINUX
+#include <sys/select.h>
 #endif
 
 GX_NS_BEGIN
@@ -23,6 +24,9 @@ public:
     static constexpr const unsigned poll_err          = (1 << 2);
     static constexpr const unsigned poll_open         = (1 << 3);
     static constexpr const unsigned poll_close        = (1 << 4);
+    static constexpr const unsigned poll_direct       = (1 << 5);
+    static constexpr const unsigned poll_high         = (1 << 6);
+    static constexpr const unsigned poll_low          = (1 << 7);
 
 public:
     Reactor(ptr<TimerManager> timermgr, unsigned maxfds = 65536, unsigned maxevents = 128) noexcept;
@@ -34,21 +38,74 @@ public:
     unsigned maxfds() const noexcept {
         return _maxfds;
     }
+    bool uring() const noexcept {
+#ifdef GX_REACTOR_USE_URING
+        return _uring.valid();
+#else
+        return false;
+#endif
+    }
+
+    /* Output flush policy
+     * Pending output is flushed after the timers and again after the socket
+     * handlers of every loop. With a delay set, the flush is held back until
+     * flush_bytes are pending or the oldest output is delay ms old.
+     */
+    size_t flush_bytes() const noexcept {
+        return _flush_bytes;
+    }
+    void flush_bytes(size_t value) noexcept {
+        _flush_bytes = value;
+    }
+    timeval_t flush_delay() const noexcept {
+        return _flush_delay;
+    }
+    void flush_delay(timeval_t value) noexcept {
+        _flush_delay = value;
+    }
+    void flush(bool force = true) noexcept;
 private:
+    int poll(timeval_t timeout);
     bool modify(Socket *io) noexcept;
     void push() noexcept;
+    bool watermark(Socket *socket) noexcept;
     void close(int fd, timeval_t linger = 0) noexcept;
     void send(Socket *socket);
 
     static timeval_t on_linger_timer(Socket *socket, Timer&, timeval_t) noexcept;
     static bool on_linger_data(Socket &socket, unsigned flags) noexcept;
 
+#ifdef GX_REACTOR_USE_URING
+    enum {
+        uring_poll = 1,
+        uring_recv,
+        uring_send,
+        uring_accept,
+        uring_cancel,
+    };
+    static uint64_t uring_data(Socket *socket, unsigned op) noexcept {
+        return (uint64_t)(uintptr_t)socket | op;
+    }
+    void uring_arm(Socket *socket) noexcept;
+    void uring_poll_add(Socket *socket) noexcept;
+    void uring_recv_add(Socket *socket) noexcept;
+    void uring_send_add(Socket *socket) noexcept;
+    void uring_accept_add(Socket *socket) noexcept;
+    void uring_cancel_add(Socket *socket, unsigned op) noexcept;
+    void uring_complete(const URing::cqe_type &cqe) noexcept;
+    int uring_loop(timeval_t timeout);
+#endif
+
 private:
     typedef gx_list(Socket, _entry) SocketList;
 #if defined(GX_REACTOR_USE_EPOLL)
     int _fd;
     struct ::epoll_event *_events;
     std::vector<ptr<Socket>> _fds;
+#ifdef GX_REACTOR_USE_URING
+    URing _uring;
+    URing::cqe_type *_cqes;
+#endif
 #elif defined(GX_REACTOR_USE_SELECT)
 	std::map<fd_t, ptr<Socket>> _fds;
 #endif
@@ -57,6 +114,9 @@ private:
 	SocketList _sock_list;
     SocketList _send_list;
     ptr<TimerManager> _timermgr;
+    size_t _flush_bytes;
+    timeval_t _flush_delay;
+    timeval_t _flush_time;
 };
 
 GX_NS_END
@@ -18,66 +18,103 @@ void ServletManager::registerServlet(ptr<ServletBase> servlet, bool use_coroutin
     servlet->_use_coroutine = use_coroutine;
 }
 
-inline void ServletManager::execute(Context *ctx) {
-    int rc = 0;
-
-    if (!ctx->peer()) {
+/* hands the response to whoever asked, the peer or a local caller */
+inline void ServletManager::reply(Context *ctx, IResponse *rsp) noexcept {
+    if (ctx->_call) {
+        ctx->_call->result = GX_CALL_OK;
         return;
     }
+    if (ctx->peer() && rsp) {
+        if (ctx->_servlet->dump_msg()) {
+            rsp->dump(nullptr, 0, ctx->pool());
+            ctx->pool()->grow1('\0');
+            log_debug("\n%s", (char*)ctx->pool()->finish());
+        }
+        ctx->peer()->send(ctx->_servlet->id(), ctx->_seq, rsp);
+    }
+}
 
-    ServletBase *servlet = ctx->_servlet;
-    ISerial *req = servlet->create_request(ctx->peer()->input(), ctx->_size, ctx->pool());
-    if (!req) {
-        ctx->rollback(false);
-        log_debug("unserial protocol '%x' failed.", servlet->id());
-        ctx->peer()->close();
-        return;
+/* reads the request and makes the response, false when there's nothing to run */
+inline bool ServletManager::prepare(Context *ctx, ISerial *&req, IResponse *&rsp) noexcept {
+    Call *call = ctx->_call;
+
+    if (!call && !ctx->peer()) {
+        return false;
     }
 
-    IResponse *rsp = servlet->create_response(ctx->pool());
+    ServletBase *servlet = ctx->_servlet;
+    if (call) {
+        /* a local caller, the request and response are its own objects */
+        req = call->req;
+        rsp = call->rsp;
+    }
+    else {
+        Stream &input = ctx->_input ? *ctx->_input : ctx->peer()->input();
+        req = servlet->create_request(input, ctx->_size, ctx->pool());
+        if (!req) {
+            ctx->rollback(false);
+            log_debug("unserial protocol '%x' failed.", servlet->id());
+            ctx->peer()->close();
+            return false;
+        }
+        rsp = servlet->create_response(ctx->pool());
+    }
 
     if (servlet->dump_msg()) {
         req->dump(nullptr, 0, ctx->pool());
         ctx->pool()->grow1('\0');
         log_debug("\n%s", (char*)ctx->pool()->finish());
     }
+    return true;
+}
+
+inline void ServletManager::execute(Context *ctx) {
+    ISerial *req;
+    IResponse *rsp;
+    if (!prepare(ctx, req, rsp)) {
+        return;
+    }
 
+    int rc = 0;
+    std::exception_ptr e;
     try {
-        if ((rc = servlet->execute(req, rsp)) < 0) {
+        rc = ctx->_servlet->execute(req, rsp);
+    } catch (...) {
+        e = std::current_exception();
+    }
+    complete(ctx, rsp, rc, e);
+}
+
+/* commits or rolls back and replies, e is what execute threw if anything */
+void ServletManager::complete(Context *ctx, IResponse *rsp, int rc, std::exception_ptr e) {
+    ServletBase *servlet = ctx->_servlet;
+    try {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+        if (rc < 0) {
             ctx->rollback(false);
             if (ctx->peer()) {
                 ctx->peer()->close();
             }
         }
         else {
+            if (rsp) {
+                rsp->rc = rc;
+            }
             if (rc) {
                 ctx->rollback(false);
             }
             else {
                 ctx->commit();
             }
-
-            if (ctx->peer()) {
-                if (rsp) {
-                    if (ctx->_servlet->dump_msg()) {
-                        rsp->dump(nullptr, 0, ctx->pool());
-                        ctx->pool()->grow1('\0');
-                        log_debug("\n%s", (char*)ctx->pool()->finish());
-                    }
-                    ctx->peer()->send(ctx->_servlet->id(), ctx->_seq, rsp);
-                }
-            }
+            reply(ctx, rsp);
         }
     } catch (ServletException &e) {
-        if (ctx->peer() && rsp) {
+        if (rsp) {
             rsp->rc = e.rc;
-            if (ctx->_servlet->dump_msg()) {
-                rsp->dump(nullptr, 0, ctx->pool());
-                ctx->pool()->grow1('\0');
-                log_debug("\n%s", (char*)ctx->pool()->finish());
-            }
-            ctx->peer()->send(ctx->_servlet->id(), ctx->_seq, rsp);
         }
+        reply(ctx, rsp);
         ctx->rollback(true);
     } catch (CallCancelException&) {
         ctx->rollback(false);
@@ -88,24 +125,159 @@ inline void ServletManager::execute(Context *ctx) {
     }
 }
 
-void ServletManager::routine(void *param) noexcept {
-    timeval_t t1 = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()
-    ).count();
+/* runs an async servlet on the calling stack up to its first suspension */
+void ServletManager::start(const ptr<Context> &ctx) noexcept {
+    ISerial *req;
+    IResponse *rsp;
+    if (!prepare(ctx, req, rsp)) {
+        done(ctx);
+        return;
+    }
+    ctx->_servlet->execute_async(ctx, req, rsp);
+}
+
+void ServletManager::done(Context *ctx) noexcept {
+    Call *call = ctx->_call;
+    Context *caller = nullptr;
+    if (call) {
+        caller = call->ctx;
+        if (call->result == GX_CALL_UNKNOWN) {
+            call->result = GX_CALL_CANCEL;
+        }
+    }
+    ctx->finish();
+    if (caller) {
+        caller->call_done();
+    }
+}
+
+void ServletBase::complete(Context *ctx, IResponse *rsp, int rc, std::exception_ptr e) noexcept {
+    ServletManager::instance()->complete(ctx, rsp, rc, e);
+    ServletManager::done(ctx);
+}
+
+inline void ServletManager::profile(Context *ctx) noexcept {
+    ServletBase *servlet = ctx->_servlet;
+    if (servlet && Coroutine::profile()) {
+        size_t used = Coroutine::self()->stack_used();
+        size_t seen = servlet->_stack_used.load(std::memory_order_relaxed);
+        while (used > seen && !servlet->_stack_used.compare_exchange_weak(seen, used, std::memory_order_relaxed)) {
+            /* seen reloaded, another loop raised it */
+        }
+    }
+}
+
+void ServletManager::dump_stack() const noexcept {
+    for (auto &it : _map) {
+        ServletBase *servlet = it.second;
+        log_info("servlet '%s(%x)' stack %lu, used %lu.", servlet->name(), servlet->id(),
+            (unsigned long)Coroutine::stack_class_size(servlet->_stack_class),
+            (unsigned long)servlet->stack_used());
+    }
+}
+
+/* a request that came in while no coroutine could be spawned */
+struct PendingRequest {
+    ServletBase *servlet;
+    unsigned seq;
+    unsigned size;
+    weak_ptr<Peer> peer;
+    Stream input;
+    stlist_entry _entry;
+};
+
+typedef gx_list(PendingRequest, _entry) pending_list_t;
+static thread_local pending_list_t __pending[Coroutine::STACK_CLASSES];
+static thread_local size_t __pending_count;
+
+void ServletManager::run(Context *ctx, Peer *peer) noexcept {
+    /* monotime() is cached per loop iteration, time this on the real clock */
+    auto t1 = std::chrono::steady_clock::now();
 
-    Peer *peer = static_cast<Peer*>(param);
-    Context *ctx = Coroutine::self()->context();
     if (ctx->begin(peer->network(), peer)) {
-        static_cast<ServletManager*>(param)->execute(ctx);
+        instance()->execute(ctx);
     }
+    profile(ctx);
     ctx->finish();
 
-    timeval_t t2 = std::chrono::duration_cast<std::chrono::milliseconds>(
-        std::chrono::system_clock::now().time_since_epoch()
-    ).count();
-    log_debug("servlet running time %lu.", t2 - t1);
+    log_debug("servlet running time %ldus.", (long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - t1).count());
 }
 
+/* runs the queued requests this coroutine's stack is big enough for */
+void ServletManager::drain(Context *ctx) noexcept {
+    unsigned stack_class = Coroutine::self()->stack_class();
+    for (unsigned i = 0; i <= stack_class; ++i) {
+        PendingRequest *pending;
+        while ((pending = __pending[i].pop_front())) {
+            __pending_count--;
+            if (pending->peer) {
+                /* the previous request's depth isn't this one's */
+                if (Coroutine::profile()) {
+                    Coroutine::self()->repaint();
+                }
+                ctx->_servlet = pending->servlet;
+                ctx->_seq = pending->seq;
+                ctx->_size = pending->size;
+                ctx->_input = &pending->input;
+                run(ctx, pending->peer);
+            }
+            delete pending;
+        }
+    }
+}
+
+void ServletManager::routine(void *param) noexcept {
+    run(Coroutine::self()->context(), static_cast<Peer*>(param));
+    if (!Coroutine::is_main_routine()) {
+        drain(Coroutine::self()->context());
+    }
+}
+
+void ServletManager::pending_routine(void*) noexcept {
+    drain(Coroutine::self()->context());
+}
+
+bool ServletManager::queue(ServletBase *servlet, unsigned seq, unsigned size, Peer *peer) noexcept {
+    if (__pending_count >= _queue_limit) {
+        return false;
+    }
+    PendingRequest *pending = new PendingRequest;
+    pending->servlet = servlet;
+    pending->seq = seq;
+    pending->size = size;
+    pending->peer = peer;
+
+    Stream &input = peer->input();
+    while (size) {
+        size_t space;
+        char *p = pending->input.reserve(space);
+        if (space > size) {
+            space = size;
+        }
+        input.read(p, space);
+        pending->input.commit(space);
+        size -= space;
+    }
+    __pending[servlet->stack_class()].push_back(pending);
+    __pending_count++;
+    return true;
+}
+
+void ServletManager::resume_pending() noexcept {
+    for (unsigned i = 0; i < Coroutine::STACK_CLASSES && __pending_count; ++i) {
+        if (!__pending[i].empty()) {
+            Coroutine *co = Coroutine::spawn(pending_routine, nullptr, i);
+            if (co) {
+                co->resume();
+            }
+        }
+    }
+}
+
+size_t ServletManager::pending() const noexcept {
+    return __pending_count;
+}
 
 void ServletManager::execute(unsigned servlet_id, unsigned seq, unsigned size, Peer *peer) noexcept {
     if (servlet_id == GX_KEEPALIVE_SERVLET) {
@@ -125,18 +297,38 @@ void ServletManager::execute(unsigned servlet_id, unsigned seq, unsigned size, P
 
     ServletBase *servlet = it->second;
 
+    if (servlet->is_async()) {
+        ptr<Context> ctx = Context::factory();
+        ctx->_servlet = servlet;
+        ctx->_seq = seq;
+        ctx->_size = size;
+        if (ctx->begin(peer->network(), peer)) {
+            start(ctx);
+        }
+        else {
+            ctx->finish();
+        }
+        return;
+    }
+
     Coroutine *co;
     bool use_co = servlet->use_coroutine();
     if (use_co) {
-        co = Coroutine::spawn(routine, peer);
+        if (__pending_count) {
+            resume_pending();
+        }
+        /* keep the order, nothing overtakes what is already queued */
+        co = __pending[servlet->stack_class()].empty() ? Coroutine::spawn(routine, peer, servlet->stack_class()) : nullptr;
     }
     else {
         co = Coroutine::self();
     }
 
     if (!co) {
-        log_debug("no coroutine available.");
-        peer->input().read(nullptr, size);
+        if (!queue(servlet, seq, size, peer)) {
+            log_warning("no coroutine available, servlet 0x%x request dropped.", servlet_id);
+            peer->input().read(nullptr, size);
+        }
         return;
     }
 
@@ -152,6 +344,78 @@ void ServletManager::execute(unsigned servlet_id, unsigned seq, unsigned size, P
     }
 }
 
+void ServletManager::local_routine(void *param) noexcept {
+    Network *network = static_cast<Network*>(param);
+    Context *ctx = Coroutine::self()->context();
+    Call *call = ctx->_call;
+    Context *caller = call->ctx;
+    if (ctx->begin(network, nullptr)) {
+        instance()->execute(ctx);
+    }
+    if (call->result == GX_CALL_UNKNOWN) {
+        call->result = GX_CALL_CANCEL;
+    }
+    profile(ctx);
+    ctx->finish();
+    if (caller) {
+        caller->call_done();
+    }
+    drain(ctx);
+}
+
+bool ServletManager::call(Network *network, Call *call, Context *from) noexcept {
+    auto it = _map.find(call->servlet);
+    if (it == _map.end()) {
+        return false;
+    }
+
+    ServletBase *servlet = it->second;
+    if (!call->ctx) {
+        /* a post, the sender may change or drop req once it returns */
+        Stream stream;
+        if (!call->req->serial(stream)) {
+            return false;
+        }
+        call->req = static_cast<INotify*>(servlet->create_request(stream, stream.size(), from->pool()));
+        if (!call->req) {
+            return false;
+        }
+    }
+    if (!call->rsp) {
+        call->rsp = servlet->create_response(from->pool());
+    }
+    if (servlet->is_async()) {
+        ptr<Context> ctx = Context::factory();
+        ctx->_servlet = servlet;
+        ctx->_call = call;
+        from->pool();
+        ctx->_pool = from->_pool;
+        call->result = GX_CALL_UNKNOWN;
+        if (ctx->begin(network, nullptr)) {
+            start(ctx);
+        }
+        else {
+            done(ctx);
+        }
+        return true;
+    }
+
+    Coroutine *co = Coroutine::spawn(local_routine, network, servlet->stack_class());
+    if (!co) {
+        log_debug("no coroutine available.");
+        return false;
+    }
+
+    Context *ctx = co->context();
+    ctx->_servlet = servlet;
+    ctx->_call = call;
+    from->pool();
+    ctx->_pool = from->_pool;
+    call->result = GX_CALL_UNKNOWN;
+    co->resume();
+    return true;
+}
+
 void ServletManager::execute(unsigned servlet_id, ISerial *req, IResponse *rsp) noexcept {
     auto it = _map.find(servlet_id);
     if (it == _map.end()) {
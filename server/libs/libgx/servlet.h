@@ -3,19 +3,24 @@
 
 #include <unordered_map>
 #include <exception>
+#include <atomic>
 #include "platform.h"
 #include "singleton.h"
 #include "serial.h"
 #include "peer.h"
 #include "network.h"
 #include "context.h"
+#include "coroutine.h"
 #include "network.h"
 #include "log.h"
 
 GX_NS_BEGIN
 
+class Task;
+
 class ServletBase : public Object {
     friend class ServletManager;
+    friend class Task;
 public:
     ServletBase(unsigned id, const char *name, bool use_coroutine = true) noexcept
     : _id(id), 
@@ -23,7 +28,10 @@ public:
       _use_coroutine(use_coroutine), 
       _dump_msg(false),
       _short_link(false),
-      _linger()
+      _linger(),
+      _stack_class(Coroutine::STACK_MEDIUM),
+      _stack_used(),
+      _async()
     { }
 
     unsigned id() const noexcept {
@@ -35,6 +43,10 @@ public:
     bool use_coroutine() const noexcept {
         return _use_coroutine;
     }
+    /* execute is a stackless Task, see task.h */
+    bool is_async() const noexcept {
+        return _async;
+    }
 
     virtual ISerial *create_request(Stream &stream, unsigned size, Obstack *pool) = 0;
     virtual IResponse *create_response(Obstack *pool) = 0;
@@ -79,8 +91,43 @@ public:
         _short_link = value;
         _linger = linger;
     }
+    /* one of Coroutine::STACK_*, set in the constructor */
+    unsigned stack_class() const noexcept {
+        return _stack_class;
+    }
+    void stack_class(unsigned value) noexcept {
+        assert(value < Coroutine::STACK_CLASSES);
+        _stack_class = value;
+    }
+    /* deepest stack seen while Coroutine::profile() is on */
+    size_t stack_used() const noexcept {
+        return _stack_used.load(std::memory_order_relaxed);
+    }
 protected:
     static void reg(ptr<ServletBase> servlet) noexcept;
+
+    template <typename _Request>
+    static ISerial *unserial_request(Stream &stream, unsigned size, Obstack *pool) {
+        _Request *req = pool->construct<_Request>(pool);
+        size_t tmp = stream.size();
+        if (!req->unserial(stream, pool)) {
+            log_error("unserial protocol %s failed.", _Request::the_message_name);
+            return nullptr;
+        }
+        if ((tmp - stream.size()) != size) {
+            return nullptr;
+        }
+        return req;
+    }
+
+    /* Async servlets start their task here and hand the outcome to
+     * complete() once it has finished, ctx stays alive until then.
+     */
+    virtual void execute_async(const ptr<Context> &ctx, ISerial *req, IResponse *rsp) noexcept { }
+    static void complete(Context *ctx, IResponse *rsp, int rc, std::exception_ptr e) noexcept;
+    void async(bool value) noexcept {
+        _async = value;
+    }
 private:
     unsigned _id;
     const char *_name;
@@ -88,6 +135,9 @@ private:
     bool _dump_msg;
     bool _short_link;
     timeval_t _linger;
+    unsigned _stack_class;
+    std::atomic<size_t> _stack_used;    /* raised from every loop thread */
+    bool _async;
 };
 
 template <typename _T, typename _Request = typename _T::request_type, typename _Response = typename _T::response_type>
@@ -102,16 +152,7 @@ public:
     { }
 
     ISerial *create_request(Stream &stream, unsigned size, Obstack *pool) override {
-        request_type *req = pool->construct<request_type>(pool);
-        size_t tmp = stream.size();
-        if (!req->unserial(stream, pool)) {
-            log_error("unserial protocol %s failed.", request_type::the_message_name);
-            return nullptr;
-        }
-        if ((tmp - stream.size()) != size) {
-            return nullptr;
-        }
-        return req;
+        return unserial_request<request_type>(stream, size, pool);
     }
     IResponse *create_response(Obstack *pool) override {
         return pool->construct<response_type>(pool);
@@ -134,16 +175,7 @@ public:
     { }
 
     ISerial *create_request(Stream &stream, unsigned size, Obstack *pool) override {
-        request_type *req = pool->construct<request_type>(pool);
-        size_t tmp = stream.size();
-        if (!req->unserial(stream, pool)) {
-            log_error("unserial protocol %s failed.", request_type::the_message_name);
-            return nullptr;
-        }
-        if ((tmp - stream.size()) != size) {
-            return nullptr;
-        }
-        return req;
+        return unserial_request<request_type>(stream, size, pool);
     }
     IResponse *create_response(Obstack *pool) override {
         return nullptr;
@@ -157,15 +189,55 @@ public:
 
 class ServletManager : public Object, public singleton<ServletManager> {
     template <typename> friend class ServletRegister;
+    friend class ServletBase;
 public:
+    static constexpr const size_t default_queue_limit = 10000;
+public:
+    ServletManager() noexcept : _queue_limit(default_queue_limit)
+    { }
+
+    /* Requests that find the coroutine pool exhausted wait in a per-thread
+     * queue of up to queue_limit requests, 0 drops them right away.
+     */
+    size_t queue_limit() const noexcept {
+        return _queue_limit;
+    }
+    void queue_limit(size_t value) noexcept {
+        _queue_limit = value;
+    }
+    size_t pending() const noexcept;
+    void resume_pending() noexcept;
+
     void execute(unsigned servlet_id, unsigned seq, unsigned size, Peer *peer) noexcept;
     void execute(unsigned servlet_id, ISerial *req, IResponse *rsp) noexcept;
+
+    /* Runs call->servlet of this process in its own coroutine, with call->req
+     * and call->rsp used in place and the pool of from shared. Without a
+     * call->ctx waiting, req is copied into that pool first, and rsp is made
+     * there when missing. Once call->result is known, call->ctx (if any)
+     * gets call_done(). Returns false when the servlet isn't hosted here or
+     * no coroutine is free.
+     */
+    bool call(Network *network, Call *call, Context *from) noexcept;
+    void dump_stack() const noexcept;
     void registerServlet(ptr<ServletBase> servlet, bool use_coroutine, const char *file, size_t line);
 private:
     static void routine(void*) noexcept;
+    static void local_routine(void*) noexcept;
+    static void pending_routine(void*) noexcept;
+    static void run(Context *ctx, Peer *peer) noexcept;
+    static void drain(Context *ctx) noexcept;
+    bool queue(ServletBase *servlet, unsigned seq, unsigned size, Peer *peer) noexcept;
+    bool prepare(Context *ctx, ISerial *&req, IResponse *&rsp) noexcept;
     void execute(Context *ctx);
+    void complete(Context *ctx, IResponse *rsp, int rc, std::exception_ptr e);
+    void start(const ptr<Context> &ctx) noexcept;
+    static void done(Context *ctx) noexcept;
+    void reply(Context *ctx, IResponse *rsp) noexcept;
+    static void profile(Context *ctx) noexcept;
 private:
     std::unordered_map<unsigned, ptr<ServletBase>> _map;
+    size_t _queue_limit;
 };
 
 template <typename _T>
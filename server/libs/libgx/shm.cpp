@@ -0,0 +1,307 @@
+#include "shm.h"
+
+#ifdef GX_NETWORK_USE_SHM
+
+#include <cerrno>
+#include <string>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "rc.h"
+
+GX_NS_BEGIN
+
+ShmChannel::ShmChannel() noexcept
+: _base(MAP_FAILED), _tx(), _rx()
+{ }
+
+ShmChannel::~ShmChannel() noexcept {
+    if (_base != MAP_FAILED) {
+        munmap(_base, sizeof(ring) * 2);
+    }
+}
+
+bool ShmChannel::map(fd_t memfd, bool creator) noexcept {
+    _base = mmap(nullptr, sizeof(ring) * 2, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (_base == MAP_FAILED) {
+        return false;
+    }
+    ring *rings = (ring*)_base;
+    _tx = creator ? rings : rings + 1;
+    _rx = creator ? rings + 1 : rings;
+    return true;
+}
+
+bool ShmChannel::create(fd_t &memfd) noexcept {
+    memfd = memfd_create("gx-shm", MFD_CLOEXEC);
+    if (!fd_valid(memfd)) {
+        return false;
+    }
+    /* ftruncate zero fills, so both rings start empty */
+    if (ftruncate(memfd, sizeof(ring) * 2) || !map(memfd, true)) {
+        fd_close(memfd);
+        memfd = GX_FD_INVALID_VALUE;
+        return false;
+    }
+    return true;
+}
+
+bool ShmChannel::attach(fd_t memfd) noexcept {
+    struct stat st;
+    if (fstat(memfd, &st) || (size_t)st.st_size != sizeof(ring) * 2) {
+        return false;
+    }
+    return map(memfd, false);
+}
+
+inline void ShmChannel::ring_read(ring *r, uint32_t pos, char *buf, size_t size) noexcept {
+    size_t offset = pos & (ring_size - 1);
+    size_t n = ring_size - offset;
+    if (n >= size) {
+        memcpy(buf, r->data + offset, size);
+    }
+    else {
+        memcpy(buf, r->data + offset, n);
+        memcpy(buf + n, r->data, size - n);
+    }
+}
+
+inline void ShmChannel::ring_write(ring *r, uint32_t pos, const char *buf, size_t size) noexcept {
+    size_t offset = pos & (ring_size - 1);
+    size_t n = ring_size - offset;
+    if (n >= size) {
+        memcpy(r->data + offset, buf, size);
+    }
+    else {
+        memcpy(r->data + offset, buf, n);
+        memcpy(r->data, buf + n, size - n);
+    }
+}
+
+inline void ShmChannel::ring_bell(fd_t bell) noexcept {
+    char c = 0;
+    ::send(bell, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/* returns false once the peer has gone */
+bool ShmChannel::drain_bell(fd_t bell) noexcept {
+    char buf[64];
+    while (1) {
+        int n = ::recv(bell, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n < 0 && errno == EAGAIN;
+    }
+}
+
+int ShmChannel::readv(fd_t bell, const struct iovec *iov, int count) noexcept {
+    ring *r = _rx;
+    bool closed = false;
+
+    while (1) {
+        uint32_t head = r->head;
+        uint32_t avail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - head;
+        if (avail) {
+            uint32_t n = 0;
+            for (int i = 0; i < count && avail; ++i) {
+                size_t size = iov[i].iov_len < avail ? iov[i].iov_len : avail;
+                ring_read(r, head + n, (char*)iov[i].iov_base, size);
+                n += size;
+                avail -= size;
+            }
+            __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_exchange_n(&r->writer_wait, 0, __ATOMIC_SEQ_CST)) {
+                ring_bell(bell);
+            }
+            return n;
+        }
+        if (closed) {
+            return -GX_ECLOSED;
+        }
+
+        /* empty, eat the bells and ask for a new one before looking again */
+        closed = !drain_bell(bell);
+        __atomic_store_n(&r->reader_wait, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == head) {
+            return closed ? -GX_ECLOSED : 0;
+        }
+    }
+}
+
+int ShmChannel::writev(fd_t bell, const struct iovec *iov, int count) noexcept {
+    ring *r = _tx;
+    uint32_t n = 0;
+    size_t offset = 0;
+    int i = 0;
+
+    while (1) {
+        uint32_t tail = r->tail;
+        uint32_t space = ring_size - (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE));
+        uint32_t written = 0;
+        while (i < count && space) {
+            size_t size = iov[i].iov_len - offset;
+            if (size > space) {
+                size = space;
+            }
+            ring_write(r, tail + written, (const char*)iov[i].iov_base + offset, size);
+            written += size;
+            space -= size;
+            offset += size;
+            if (offset == iov[i].iov_len) {
+                offset = 0;
+                i++;
+            }
+        }
+        if (written) {
+            __atomic_store_n(&r->tail, tail + written, __ATOMIC_RELEASE);
+            n += written;
+        }
+        if (i == count) {
+            break;
+        }
+
+        /* full, ask the reader for a bell before looking again */
+        __atomic_store_n(&r->writer_wait, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == ring_size) {
+            break;
+        }
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (n && __atomic_exchange_n(&r->reader_wait, 0, __ATOMIC_SEQ_CST)) {
+        ring_bell(bell);
+    }
+    return n;
+}
+
+bool ShmChannel::is_local(const struct sockaddr_in *addr) noexcept {
+    if ((ntohl(addr->sin_addr.s_addr) >> 24) == 127) {
+        return true;
+    }
+    struct ifaddrs *ifa;
+    if (getifaddrs(&ifa)) {
+        return false;
+    }
+    bool local = false;
+    for (struct ifaddrs *p = ifa; p; p = p->ifa_next) {
+        if (p->ifa_addr && p->ifa_addr->sa_family == AF_INET &&
+            ((struct sockaddr_in*)p->ifa_addr)->sin_addr.s_addr == addr->sin_addr.s_addr) {
+            local = true;
+            break;
+        }
+    }
+    freeifaddrs(ifa);
+    return local;
+}
+
+/* abstract unix address named after the tcp address of the instance */
+static socklen_t __shm_addr(const struct sockaddr_in *addr, struct sockaddr_un *un) noexcept {
+    memset(un, 0, sizeof(*un));
+    un->sun_family = AF_UNIX;
+    int n = snprintf(un->sun_path + 1, sizeof(un->sun_path) - 1, "gx-shm-%s:%u",
+        inet_ntoa(addr->sin_addr), (unsigned)ntohs(addr->sin_port));
+    return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+fd_t ShmChannel::listen(const struct sockaddr_in *addr) noexcept {
+    struct sockaddr_un un;
+    socklen_t len = __shm_addr(addr, &un);
+    fd_t fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (!fd_valid(fd)) {
+        return GX_FD_INVALID_VALUE;
+    }
+    if (::bind(fd, (struct sockaddr*)&un, len) || ::listen(fd, SOMAXCONN)) {
+        fd_close(fd);
+        return GX_FD_INVALID_VALUE;
+    }
+    return fd;
+}
+
+fd_t ShmChannel::connect(const struct sockaddr_in *addr) noexcept {
+    struct sockaddr_un un;
+    socklen_t len = __shm_addr(addr, &un);
+    fd_t fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (!fd_valid(fd)) {
+        return GX_FD_INVALID_VALUE;
+    }
+    if (::connect(fd, (struct sockaddr*)&un, len)) {
+        fd_close(fd);
+        return GX_FD_INVALID_VALUE;
+    }
+    return fd;
+}
+
+bool ShmChannel::send_fd(fd_t sock, fd_t fd) noexcept {
+    char c = 0;
+    struct iovec iov = { &c, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    while (1) {
+        if (::sendmsg(sock, &msg, MSG_NOSIGNAL) == 1) {
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+fd_t ShmChannel::recv_fd(fd_t sock) noexcept {
+    char c;
+    struct iovec iov = { &c, 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    int n;
+    while ((n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+    if (n <= 0) {
+        if (!n) {
+            errno = ECONNRESET;
+        }
+        return GX_FD_INVALID_VALUE;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        errno = EPROTO;
+        return GX_FD_INVALID_VALUE;
+    }
+    fd_t fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+GX_NS_END
+
+#endif
+
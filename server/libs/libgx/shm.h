@@ -0,0 +1,66 @@
+#ifndef __GX_SHM_H__
+#define __GX_SHM_H__
+
+#include "platform.h"
+
+#ifdef GX_NETWORK_USE_SHM
+
+#include <netinet/in.h>
+#include "object.h"
+#include "io.h"
+
+GX_NS_BEGIN
+
+/* ShmChannel
+ * A pair of single-producer single-consumer byte rings in a memfd mapping,
+ * shared by two processes on the same host. The unix socket the memfd was
+ * handed over on stays open as the doorbell: a side rings it only when the
+ * other one has flagged that it is waiting, and its EOF tells a dead peer.
+ */
+class ShmChannel : public Object {
+public:
+    static constexpr const unsigned ring_size = 1024 * 1024;
+    static constexpr const unsigned cacheline = 64;
+
+public:
+    ShmChannel() noexcept;
+    ~ShmChannel() noexcept;
+
+    bool create(fd_t &memfd) noexcept;
+    bool attach(fd_t memfd) noexcept;
+    int readv(fd_t bell, const struct iovec *iov, int count) noexcept;
+    int writev(fd_t bell, const struct iovec *iov, int count) noexcept;
+
+    static bool is_local(const struct sockaddr_in *addr) noexcept;
+    static fd_t listen(const struct sockaddr_in *addr) noexcept;
+    static fd_t connect(const struct sockaddr_in *addr) noexcept;
+    static bool send_fd(fd_t sock, fd_t fd) noexcept;
+    static fd_t recv_fd(fd_t sock) noexcept;
+
+private:
+    struct ring {
+        alignas(cacheline) uint32_t head;
+        alignas(cacheline) uint32_t tail;
+        alignas(cacheline) uint32_t reader_wait;
+        uint32_t writer_wait;
+        alignas(cacheline) char data[ring_size];
+    };
+
+    bool map(fd_t memfd, bool creator) noexcept;
+    static void ring_read(ring *r, uint32_t pos, char *buf, size_t size) noexcept;
+    static void ring_write(ring *r, uint32_t pos, const char *buf, size_t size) noexcept;
+    static void ring_bell(fd_t bell) noexcept;
+    static bool drain_bell(fd_t bell) noexcept;
+
+private:
+    void *_base;
+    ring *_tx;
+    ring *_rx;
+};
+
+GX_NS_END
+
+#endif
+
+#endif
+
@@ -49,10 +49,20 @@ bool Address::resolve(const char *host, unsigned port) noexcept {
 }
 
 /* Socket */
-Socket::Socket() noexcept : _fd(GX_FD_INVALID_VALUE), _flags(), _reactor()
+Socket::Socket() noexcept : _fd(GX_FD_INVALID_VALUE), _flags(), _reactor(),
+  _high_watermark(), _low_watermark(), _congested()
+#ifdef GX_REACTOR_USE_URING
+, _uring_ops(), _uring_poll(), _uring_error(), _uring_listen(), _uring_accepted(GX_FD_INVALID_VALUE)
+#endif
 { }
 
 int Socket::read(void *buf, size_t size) noexcept {
+#ifdef GX_NETWORK_USE_SHM
+    if (_shm) {
+        struct iovec iov = { buf, size };
+        return _shm->readv(_fd, &iov, 1);
+    }
+#endif
     char *p = (char *)buf;
     int n = 0;
 
@@ -86,6 +96,38 @@ int Socket::read(void *buf, size_t size) noexcept {
     return n;
 }
 
+#ifndef GX_PLATFORM_WIN32
+int Socket::readv(const struct iovec *iov, int count) noexcept {
+#ifdef GX_NETWORK_USE_SHM
+    if (_shm) {
+        return _shm->readv(_fd, iov, count);
+    }
+#endif
+    int n = 0;
+    while (1) {
+        n = fd_readv(_fd, iov, count);
+        if (gx_likely(n > 0)) {
+            break;
+        }
+        else if (gx_likely(n < 0)) {
+            if (gx_likely(errno == EAGAIN)) {
+                return 0;
+            }
+            else if (gx_likely(errno == EINTR)) {
+                continue;
+            }
+            else {
+                return -errno;
+            }
+        }
+        else {
+            return -GX_ECLOSED;
+        }
+    }
+    return n;
+}
+#endif
+
 bool Socket::shutdown(bool read, bool write) noexcept {
     int value = _flags;
     if (read) {
@@ -101,6 +143,12 @@ bool Socket::shutdown(bool read, bool write) noexcept {
 }
 
 int Socket::write(const char *buf, size_t size) noexcept {
+#ifdef GX_NETWORK_USE_SHM
+    if (_shm) {
+        struct iovec iov = { (void*)buf, size };
+        return _shm->writev(_fd, &iov, 1);
+    }
+#endif
     const char *p = (const char *)buf;
     int n = 0;
     while (1) {
@@ -127,6 +175,68 @@ int Socket::write(const char *buf, size_t size) noexcept {
     return n;
 }
 
+#ifndef GX_PLATFORM_WIN32
+int Socket::writev(const struct iovec *iov, int count) noexcept {
+#ifdef GX_NETWORK_USE_SHM
+    if (_shm) {
+        return _shm->writev(_fd, iov, count);
+    }
+#endif
+    int n = 0;
+    while (1) {
+        n = fd_writev(_fd, iov, count);
+        if (gx_likely(n > 0)) {
+            break;
+        }
+        else if (gx_likely(n < 0)) {
+            if (gx_likely(errno == EAGAIN)) {
+                return 0;
+            }
+            else if (gx_likely(errno == EINTR)) {
+                continue;
+            }
+            else {
+                return -errno;
+            }
+        }
+        else {
+            return -GX_ECLOSED;
+        }
+    }
+    return n;
+}
+#endif
+
+bool Socket::direct() const noexcept {
+#ifdef GX_REACTOR_USE_URING
+#ifdef GX_NETWORK_USE_SHM
+    if (_shm) {
+        return false;
+    }
+#endif
+    return _reactor && _reactor->uring() && (_flags & Reactor::poll_direct) && !_uring_listen;
+#else
+    return false;
+#endif
+}
+
+fd_t Socket::accept(Address &addr) noexcept {
+    socklen_t len = Address::length;
+#ifdef GX_REACTOR_USE_URING
+    if (_reactor && _reactor->uring()) {
+        fd_t fd = _uring_accepted;
+        if (!fd_valid(fd)) {
+            errno = EAGAIN;
+            return GX_FD_INVALID_VALUE;
+        }
+        _uring_accepted = GX_FD_INVALID_VALUE;
+        ::getpeername(fd, addr, &len);
+        return fd;
+    }
+#endif
+    return ::accept(_fd, addr, &len);
+}
+
 void Socket::close(timeval_t linger) noexcept {
     if (_reactor && fd_valid(_fd)) {
         _reactor->close(_fd, linger);
@@ -134,6 +244,14 @@ void Socket::close(timeval_t linger) noexcept {
 }
 
 int Socket::load() noexcept {
+#ifdef GX_REACTOR_USE_URING
+    if (direct()) {
+        if (_uring_error) {
+            return _uring_error;
+        }
+        return _input.size();
+    }
+#endif
     int n = _input.load(*this);
     if (n < 0) {
         return n;
@@ -236,7 +354,7 @@ bool Connector::connect_handler(Socket &socket, unsigned type) {
 bool Connector::do_connect() {
     int n;
     close();
-    _conntime = gettimeofday();
+    _conntime = monotime();
 
     int fd;
     if (!fd_valid(fd = ::socket(AF_INET, SOCK_STREAM, 0))) {
@@ -310,6 +428,7 @@ Listener::Listener(Address &addr, ptr<Reactor> reactor, handler_type handler) no
     _addr = addr;
     _reactor = reactor;
     _backlog = default_backlog;
+    _reuse_port = false;
 }
 
 Listener::~Listener() noexcept {
@@ -325,8 +444,7 @@ bool Listener::accept_handler(Socket&, unsigned type) noexcept {
     if (type & Reactor::poll_in) {
         Address addr;
         while (1) {
-            socklen_t len = Address::length;
-            int fd = ::accept(_socket->fd(), addr, &len);
+            int fd = _socket->accept(addr);
             if (fd < 0) {
                 switch (errno) {
                 case EAGAIN:
@@ -364,6 +482,12 @@ bool Listener::listen() noexcept {
 		fd_close(fd);
         return false;
     }
+#ifdef SO_REUSEPORT
+    if (_reuse_port && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &n, sizeof(int))) {
+		fd_close(fd);
+        return false;
+    }
+#endif
     if (::bind(fd, _addr, Address::length)) {
 		fd_close(fd);
         return false;
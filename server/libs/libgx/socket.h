@@ -16,6 +16,7 @@
 #include "timermanager.h"
 #include "memory.h"
 #include "io.h"
+#include "shm.h"
 
 GX_NS_BEGIN
 
@@ -81,11 +82,46 @@ public:
         return _output;
     }
     bool shutdown(bool read, bool write) noexcept;
+
+    /* Output watermarks
+     * The handler gets poll_high once the pending output reaches high, and
+     * poll_low once a flush drains it back to low. 0 disables them.
+     */
+    void watermark(size_t high, size_t low) noexcept {
+        _high_watermark = high;
+        _low_watermark = low < high ? low : high;
+    }
+    size_t high_watermark() const noexcept {
+        return _high_watermark;
+    }
+    size_t low_watermark() const noexcept {
+        return _low_watermark;
+    }
+    bool congested() const noexcept {
+        return _congested || (_high_watermark && _output.size() >= _high_watermark);
+    }
+    bool direct() const noexcept;
+#ifdef GX_NETWORK_USE_SHM
+    /* Moves the byte stream onto a shared-memory channel, the socket
+     * itself is left as its doorbell.
+     */
+    void attach(ptr<ShmChannel> shm) noexcept {
+        _shm = shm;
+    }
+    ShmChannel *shm() const noexcept {
+        return _shm;
+    }
+#endif
+    fd_t accept(Address &addr) noexcept;
     int load() noexcept;
     int send() noexcept;
     int push() noexcept;
     int read(void *buf, size_t size) noexcept override;
     int write(const char *buf, size_t size) noexcept override;
+#ifndef GX_PLATFORM_WIN32
+    int readv(const struct iovec *iov, int count) noexcept override;
+    int writev(const struct iovec *iov, int count) noexcept override;
+#endif
     void close(timeval_t linger) noexcept;
     void close() noexcept override {
         close(0);
@@ -99,6 +135,22 @@ protected:
     Stream _input;
     Stream _output;
     weak_ptr<Timer> _timer;
+    size_t _high_watermark;
+    size_t _low_watermark;
+    bool _congested;
+#ifdef GX_NETWORK_USE_SHM
+    ptr<ShmChannel> _shm;
+#endif
+#ifdef GX_REACTOR_USE_URING
+    unsigned _uring_ops;
+    unsigned _uring_poll;
+    int _uring_error;
+    bool _uring_listen;
+    fd_t _uring_accepted;
+    ptr<Socket> _uring_hold;
+    struct msghdr _uring_msg;
+    struct iovec _uring_iov[8];
+#endif
 public:
     list_entry _entry;
 };
@@ -167,6 +219,12 @@ public:
         return _addr;
     }
     ptr<Reactor> reactor() const noexcept;
+    bool reuse_port() const noexcept {
+        return _reuse_port;
+    }
+    void reuse_port(bool value) noexcept {
+        _reuse_port = value;
+    }
     void close() noexcept;
     bool listen() noexcept;
     Socket *socket() noexcept {
@@ -185,6 +243,7 @@ private:
     ptr<Reactor> _reactor;
     handler_type _handler;
     unsigned _backlog;
+    bool _reuse_port;
 };
 
 GX_NS_END
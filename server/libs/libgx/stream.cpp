@@ -1,4 +1,5 @@
 #include "stream.h"
+#include "payload.h"
 #include "rc.h"
 
 GX_NS_BEGIN
@@ -8,6 +9,7 @@ Stream::Stream(PageAllocator *pa) noexcept {
         pa = PageAllocator::instance();
     }
     _pa = pa;
+    _shared = 0;
     init(nullptr);
 }
 
@@ -34,6 +36,9 @@ inline Page *Stream::alloc_chunk(size_t size) noexcept {
 }
 
 inline void Stream::free_chunk(Page *chunk) noexcept {
+    if (!chunk->size) {
+        _shared--;
+    }
     _pa->free(chunk);
 }
 
@@ -41,8 +46,18 @@ inline void Stream::reset_chunk(Page *chunk) noexcept {
     chunk->p = chunk->firstp = chunk->endp - chunk->size;
 }
 
+/* next free chunk of the ring, shared chunks are dropped instead of reused */
+inline Page *Stream::next_chunk(Page *chunk) noexcept {
+    Page *next;
+    while ((next = chunk->next) != _first_chunk && gx_unlikely(!next->size)) {
+        chunk->next = next->next;
+        free_chunk(next);
+    }
+    return next;
+}
+
 inline Page *Stream::new_chunk(Page *chunk) noexcept {
-    chunk = chunk->next;
+    chunk = next_chunk(chunk);
     if (chunk == _first_chunk) {
         chunk = alloc_chunk();
         chunk->next = _end_chunk->next;
@@ -57,6 +72,9 @@ inline Page *Stream::new_chunk(Page *chunk) noexcept {
 inline void Stream::init(Page *chunk) noexcept {
     if (!chunk) {
         chunk = alloc_chunk();
+    } else if (!chunk->size) {
+        free_chunk(chunk);
+        chunk = alloc_chunk();
     } else {
         reset_chunk(chunk);
     }
@@ -142,7 +160,7 @@ void Stream::write(const void *buf, size_t size, Page *chunk, size_t n) noexcept
 }
 
 void *Stream::blank(Page *chunk, size_t size) noexcept {
-    chunk = chunk->next;
+    chunk = next_chunk(chunk);
     if (chunk == _first_chunk || chunk->size < size) {
         chunk = alloc_chunk(size);
         chunk->next = _end_chunk->next;
@@ -155,6 +173,33 @@ void *Stream::blank(Page *chunk, size_t size) noexcept {
     return chunk->firstp;
 }
 
+char *Stream::reserve(size_t &space) noexcept {
+    Page *chunk = _end_chunk;
+    if (!chunk_space(chunk)) {
+        chunk = new_chunk(chunk);
+    }
+    space = chunk_space(chunk);
+    return chunk->p;
+}
+
+int Stream::gather(struct iovec *iov, int count) const noexcept {
+    int n = 0;
+    Page *chunk = _first_chunk;
+    while (n < count) {
+        size_t size = chunk_size(chunk);
+        if (size) {
+            iov[n].iov_base = chunk->firstp;
+            iov[n].iov_len = size;
+            n++;
+        }
+        if (chunk == _end_chunk) {
+            break;
+        }
+        chunk = chunk->next;
+    }
+    return n;
+}
+
 void Stream::load(const Stream &x) noexcept {
     Page *chunk = x._first_chunk;
     while (1) {
@@ -178,8 +223,11 @@ void Stream::load(Stream &&x) noexcept {
             chunk->next = _end_chunk->next;
             _end_chunk->next = chunk;
             _end_chunk = chunk;
+            if (!chunk->size) {
+                _shared++;
+            }
         } else {
-            free_chunk(chunk);
+            x.free_chunk(chunk);
         }
         if (chunk == x._end_chunk) {
             break;
@@ -188,74 +236,161 @@ void Stream::load(Stream &&x) noexcept {
     }
     x._end_chunk = nullptr;
     x._size = 0;
+    x._shared = 0;
 }
 
 int Stream::load(IO &x) noexcept {
+    struct iovec iov[load_chunks + 1];
+    Page *chunks[load_chunks + 1];
     int count = 0;
-    Page *chunk = _end_chunk;
+    bool grow = false;
 
     while (1) {
-        size_t space = chunk_space(chunk);
-        if (space) {
-            int n = x.read(chunk->p, space);
-            if (gx_likely(n > 0)) {
-                count += n;
-                chunk->p += n;
-                _size += n;
-                /*
-                if ((size_t)n < space) {
-                    return count;
-                }*/
-            } else if (gx_likely(n == 0)) {
-                return count;
-            } else if (n == -GX_ECLOSED) {
-                if (count) {
-                    return count;
-                }
-                else {
-                    return n;
+        /* tail space first, then the free chunks of the ring */
+        int n = 0;
+        size_t size = 0;
+        Page *chunk = _end_chunk;
+        if (chunk_space(chunk)) {
+            chunks[n++] = chunk;
+        }
+        while (n <= load_chunks && next_chunk(chunk) != _first_chunk) {
+            chunk = chunk->next;
+            reset_chunk(chunk);
+            chunks[n++] = chunk;
+        }
+
+        int linked = n;
+        for (int i = 0; i < n; ++i) {
+            iov[i].iov_base = chunks[i]->p;
+            iov[i].iov_len = chunk_space(chunks[i]);
+            size += iov[i].iov_len;
+        }
+
+        /* spare chunks when little space is at hand, or while the previous
+         * read filled all it was offered
+         */
+        if (grow || size < load_min) {
+            while (n <= load_chunks) {
+                chunks[n] = alloc_chunk();
+                iov[n].iov_base = chunks[n]->p;
+                iov[n].iov_len = chunk_space(chunks[n]);
+                size += iov[n++].iov_len;
+            }
+        }
+
+        int r = x.readv(iov, n);
+        size_t left = r > 0 ? r : 0;
+        for (int i = 0; i < n; ++i) {
+            chunk = chunks[i];
+            if (left) {
+                size_t k = left < iov[i].iov_len ? left : iov[i].iov_len;
+                chunk->p += k;
+                left -= k;
+                if (i >= linked) {
+                    chunk->next = _end_chunk->next;
+                    _end_chunk->next = chunk;
                 }
+                _end_chunk = chunk;
             }
-            else {
-                return n;
+            else if (i >= linked) {
+                free_chunk(chunk);
             }
+        }
 
+        if (gx_likely(r > 0)) {
+            count += r;
+            _size += r;
+            grow = (size_t)r == size;
+        } else if (gx_likely(r == 0)) {
+            return count;
+        } else if (r == -GX_ECLOSED) {
+            if (count) {
+                return count;
+            }
+            else {
+                return r;
+            }
+        }
+        else {
+            return r;
         }
-        chunk = new_chunk(chunk);
     }
 }
 
 int Stream::save(IO &x) noexcept {
+    struct iovec iov[iov_max];
     int count = 0;
-    Page *chunk = _first_chunk;
-    while (1) {
-        size_t size = chunk_size(chunk);
-        if (size) {
-            int n = x.write(chunk->firstp, size);
-            if (gx_likely(n > 0)) {
-                count += n;
-                chunk->firstp += n;
-                _size -= n;
-                /*
-                if ((size_t)n < size) {
-                    _first_chunk = chunk;
-                    return count;
-                }*/
-            } else if (gx_likely(n == 0)) {
-                _first_chunk = chunk;
-                return count;
-            } else {
-                _first_chunk = chunk;
-                return n;
+    while (_size) {
+        int n = gather(iov, iov_max);
+        size_t size = 0;
+        for (int i = 0; i < n; ++i) {
+            size += iov[i].iov_len;
+        }
+        n = x.writev(iov, n);
+        if (gx_likely(n > 0)) {
+            count += n;
+            read(nullptr, n);
+            if ((size_t)n < size) {
+                break;
             }
+        } else if (gx_likely(n == 0)) {
+            break;
+        } else {
+            return n;
         }
-        if (chunk == _end_chunk) {
-            _first_chunk = chunk;
-            return count;
+    }
+    release_shared();
+    return count;
+}
+
+void Stream::link(const Payload *payload) noexcept {
+    const Stream &x = payload->stream();
+    if (x.size() < link_min) {
+        load(x);
+        return;
+    }
+    Page *chunk = x._first_chunk;
+    while (1) {
+        size_t n = chunk_size(chunk);
+        if (n) {
+            Page *shared = _pa->share(chunk->firstp, chunk->p, payload);
+            shared->next = _end_chunk->next;
+            _end_chunk->next = shared;
+            _end_chunk = shared;
+            _size += n;
+            _shared++;
+        }
+        if (chunk == x._end_chunk) {
+            break;
         }
         chunk = chunk->next;
     }
 }
 
+/* give consumed shared chunks back to their payloads */
+void Stream::release_shared() noexcept {
+    if (gx_likely(!_shared)) {
+        return;
+    }
+    if (!_size) {
+        clear();
+        return;
+    }
+    while (_first_chunk != _end_chunk && !chunk_size(_first_chunk)) {
+        _first_chunk = _first_chunk->next;
+    }
+    Page *chunk = _end_chunk;
+    while (chunk->next != _first_chunk) {
+        Page *next = chunk->next;
+        if (!next->size) {
+            chunk->next = next->next;
+            free_chunk(next);
+        }
+        else {
+            chunk = next;
+        }
+    }
+}
+
 GX_NS_END
 
@@ -8,7 +8,14 @@
 
 GX_NS_BEGIN
 
+class Payload;
+
 class Stream : public Object {
+public:
+    static constexpr const int iov_max = 64;
+    static constexpr const int load_chunks = 2;
+    static constexpr const size_t load_min = 4096;
+    static constexpr const size_t link_min = 512;
 protected:
     static size_t chunk_size(Page *chunk) noexcept {
         return chunk->p - chunk->firstp;
@@ -18,7 +25,7 @@ protected:
     }
 public:
     Stream(PageAllocator *pa = nullptr) noexcept;
-    Stream(Stream &&x) : _end_chunk(), _size() {
+    Stream(Stream &&x) : _end_chunk(), _size(), _shared() {
         swap(x);
     }
     ~Stream() noexcept;
@@ -28,6 +35,7 @@ public:
         std::swap(_first_chunk, x._first_chunk);
         std::swap(_end_chunk, x._end_chunk);
         std::swap(_size, x._size);
+        std::swap(_shared, x._shared);
     }
     std::size_t size() const noexcept {
         return _size;
@@ -74,6 +82,15 @@ public:
         }
         return blank(chunk, size);
     }
+    char *reserve(size_t &space) noexcept;
+    void commit(size_t size) noexcept {
+        assert(size <= chunk_space(_end_chunk));
+        _end_chunk->p += size;
+        _size += size;
+    }
+    int gather(struct iovec *iov, int count) const noexcept;
+    void link(const Payload *payload) noexcept;
+    void release_shared() noexcept;
     void load(const Stream &x) noexcept;
     void load(Stream &&x) noexcept;
     int load(IO &x) noexcept;
@@ -155,6 +172,7 @@ public:
 
 private:
     void init(Page *chunk) noexcept;
+    Page *next_chunk(Page *chunk) noexcept;
     Page *new_chunk(Page *chunk) noexcept;
     Page *alloc_chunk(size_t size = 1) noexcept;
     void free_chunk(Page *chunk) noexcept;
@@ -167,6 +185,7 @@ private:
     Page *_first_chunk;
     Page *_end_chunk;
     std::size_t _size;
+    unsigned _shared;
 };
 
 GX_NS_END
@@ -0,0 +1,270 @@
+#ifndef __GX_TASK_H__
+#define __GX_TASK_H__
+
+#include "platform.h"
+
+#ifdef GX_USE_CO_AWAIT
+
+#include <coroutine>
+#include <exception>
+#include "object.h"
+#include "obstack.h"
+#include "context.h"
+#include "network.h"
+#include "servlet.h"
+#include "application.h"
+
+GX_NS_BEGIN
+
+/* Task
+ * The return type of a stackless servlet body, see AsyncServlet. It runs on
+ * the stack of whoever resumes it, the main routine, so the_context() and
+ * anything that yields the current Coroutine must not be used inside: the
+ * context is the explicit ctx parameter and waiting goes through co_await.
+ * Frames come from the pool of that ctx when it is the first parameter.
+ */
+class Task {
+public:
+    struct promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    struct final_awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(handle_type h) noexcept {
+            promise_type &p = h.promise();
+            ptr<Context> ctx = p.ctx;
+            IResponse *rsp = p.rsp;
+            int rc = p.rc;
+            std::exception_ptr e = std::move(p.e);
+            /* the frame lives in ctx's pool, it goes before the pool does */
+            h.destroy();
+            ServletBase::complete(ctx, rsp, rc, e);
+        }
+        void await_resume() const noexcept { }
+    };
+
+    struct promise_type {
+        ptr<Context> ctx;
+        IResponse *rsp = nullptr;
+        int rc = 0;
+        std::exception_ptr e;
+
+        Task get_return_object() noexcept {
+            return Task(handle_type::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() const noexcept {
+            return {};
+        }
+        final_awaiter final_suspend() const noexcept {
+            return {};
+        }
+        void return_value(int value) noexcept {
+            rc = value;
+        }
+        void unhandled_exception() noexcept {
+            e = std::current_exception();
+        }
+
+        template <typename ..._Args>
+        static void *operator new(size_t size, Context *ctx, _Args&...) {
+            return alloc(size, ctx->pool());
+        }
+        template <typename _Self, typename ..._Args>
+        static void *operator new(size_t size, _Self&, Context *ctx, _Args&...) {
+            return alloc(size, ctx->pool());
+        }
+        static void *operator new(size_t size) {
+            return alloc(size, nullptr);
+        }
+        static void operator delete(void *p, size_t) noexcept {
+            /* pool frames go with the pool */
+            header *h = static_cast<header*>(p) - 1;
+            if (!h->pool) {
+                ::operator delete(h);
+            }
+        }
+    private:
+        union alignas(std::max_align_t) header {
+            Obstack *pool;
+        };
+        static void *alloc(size_t size, Obstack *pool) {
+            header *h;
+            if (pool) {
+                /* the pool only aligns to gx_align_size */
+                uintptr_t p = (uintptr_t)pool->alloc(sizeof(header) + size + alignof(header) - gx_align_size);
+                h = (header*)gx_align(p, alignof(header));
+            }
+            else {
+                h = static_cast<header*>(::operator new(sizeof(header) + size));
+            }
+            h->pool = pool;
+            return h + 1;
+        }
+    };
+
+public:
+    Task(Task &&x) noexcept : _h(x._h) {
+        x._h = nullptr;
+    }
+    Task(const Task&) = delete;
+    ~Task() noexcept {
+        if (_h) {
+            _h.destroy();
+        }
+    }
+
+    /* runs up to the first suspension, the frame frees itself once done */
+    void start(const ptr<Context> &ctx, IResponse *rsp) noexcept {
+        handle_type h = _h;
+        _h = nullptr;
+        h.promise().ctx = ctx;
+        h.promise().rsp = rsp;
+        ctx->wake_with(resume, h.address());
+        h.resume();
+    }
+
+private:
+    explicit Task(handle_type h) noexcept : _h(h)
+    { }
+    static void resume(void *address) noexcept {
+        handle_type::from_address(address).resume();
+    }
+private:
+    handle_type _h;
+};
+
+/* co_await async_sleep(ctx, time) */
+class SleepAwaiter {
+public:
+    SleepAwaiter(Context *ctx, timeval_t time) noexcept : _ctx(ctx), _time(time)
+    { }
+    bool await_ready() const noexcept {
+        return !_time;
+    }
+    void await_suspend(std::coroutine_handle<>) noexcept {
+        Context *ctx = _ctx;
+        the_app->timer_manager()->schedule(_time, [ctx](Timer&, timeval_t) {
+            ctx->wake();
+            return 0;
+        });
+    }
+    void await_resume() const noexcept { }
+private:
+    Context *_ctx;
+    timeval_t _time;
+};
+
+inline SleepAwaiter async_sleep(Context *ctx, timeval_t time) noexcept {
+    return SleepAwaiter(ctx, time);
+}
+
+/* int rc = co_await async_call(ctx, msg), throws as Network::call does */
+template <typename _Message>
+class CallAwaiter {
+public:
+    CallAwaiter(Context *ctx, _Message &msg, NetworkInstance *instance) noexcept
+    : _ctx(ctx), _msg(msg), _call(msg.req->id(), _Message::the_message_id, msg.req, nullptr, instance), _waited()
+    { }
+    bool await_ready() {
+        assert(_msg.req->id());
+        Obstack *pool = _ctx->pool();
+        _msg.rsp = pool->construct<typename _Message::response_type>(pool);
+        _call.rsp = _msg.rsp;
+        _waited = _ctx->network()->call_start(_ctx, &_call);
+        return !_waited;
+    }
+    void await_suspend(std::coroutine_handle<>) noexcept { }
+    int await_resume() {
+        _ctx->network()->call_finish(_ctx, &_call, _waited);
+        if (_msg.rsp->rc >= GX_ESYS_RC && _msg.rsp->rc < GX_ESYS_END) {
+            throw ServletException(_msg.rsp->rc);
+        }
+        return _msg.rsp->rc;
+    }
+private:
+    Context *_ctx;
+    _Message &_msg;
+    Call _call;
+    bool _waited;
+};
+
+template <typename _Message>
+inline CallAwaiter<_Message> async_call(Context *ctx, _Message &msg, NetworkInstance *instance = nullptr) noexcept {
+    return CallAwaiter<_Message>(ctx, msg, instance);
+}
+
+/* AsyncServlet
+ * A servlet whose execute is a Task instead of a call on a coroutine stack:
+ *
+ *   Task execute(Context *ctx, request_type *req, response_type *rsp) override {
+ *       int rc = co_await async_call(ctx, msg);
+ *       co_return rc;
+ *   }
+ */
+template <typename _T, typename _Request = typename _T::request_type, typename _Response = typename _T::response_type>
+class AsyncServlet : public ServletBase {
+public:
+    typedef _T type;
+    typedef _Request request_type;
+    typedef _Response response_type;
+public:
+    AsyncServlet() noexcept
+    : ServletBase(type::the_message_id, type::the_message_name, false)
+    {
+        async(true);
+    }
+
+    ISerial *create_request(Stream &stream, unsigned size, Obstack *pool) override {
+        return unserial_request<request_type>(stream, size, pool);
+    }
+    IResponse *create_response(Obstack *pool) override {
+        return pool->construct<response_type>(pool);
+    }
+    int execute(ISerial *req, IResponse *rsp) override {
+        assert(0);
+        return -1;
+    }
+    virtual Task execute(Context *ctx, request_type *req, response_type *rsp) = 0;
+protected:
+    void execute_async(const ptr<Context> &ctx, ISerial *req, IResponse *rsp) noexcept override {
+        execute(ctx, static_cast<request_type*>(req), static_cast<response_type*>(rsp)).start(ctx, rsp);
+    }
+};
+
+template <typename _T>
+class AsyncServlet<_T, typename _T::request_type, void> : public ServletBase {
+public:
+    typedef _T type;
+    typedef typename _T::request_type request_type;
+public:
+    AsyncServlet() noexcept
+    : ServletBase(type::the_message_id, type::the_message_name, false)
+    {
+        async(true);
+    }
+
+    ISerial *create_request(Stream &stream, unsigned size, Obstack *pool) override {
+        return unserial_request<request_type>(stream, size, pool);
+    }
+    IResponse *create_response(Obstack *pool) override {
+        return nullptr;
+    }
+    int execute(ISerial *req, IResponse *rsp) override {
+        assert(0);
+        return -1;
+    }
+    virtual Task execute(Context *ctx, request_type *req) = 0;
+protected:
+    void execute_async(const ptr<Context> &ctx, ISerial *req, IResponse *rsp) noexcept override {
+        execute(ctx, static_cast<request_type*>(req)).start(ctx, rsp);
+    }
+};
+
+GX_NS_END
+
+#endif
+
+#endif
+
@@ -0,0 +1,53 @@
+/* Closing a peer with calls in flight must take their seqs out of the
+ * network's call table, a stale slot made the table double on every new
+ * seq landing on it. Built with -fno-access-control, see Makefile.am.
+ */
+#include <cstdio>
+#include "network.h"
+#include "context.h"
+#include "peer.h"
+
+GX_NS_USING
+
+static int failed = 0;
+
+#define check(x) do {                                       \
+    if (!(x)) {                                             \
+        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #x); \
+        failed++;                                           \
+    }                                                       \
+} while (0)
+
+int main() {
+    const unsigned count = 4;
+    object<Network> network;
+    ptr<Context> ctx = Context::factory();
+    Call calls[count];
+
+    ptr<Peer> peer = object<Peer>(false);
+    peer->_network = network;
+    network->_connect_list.push_front(peer);
+    for (unsigned i = 0; i < count; ++i) {
+        Call &call = calls[i];
+        call.ctx = ctx;
+        call.seq = i + 1;
+        check(network->_calls.insert(call.seq, ctx, &call));
+        peer->_call_list.push_front(&call);
+    }
+    peer = nullptr;
+
+    for (unsigned i = 0; i < count; ++i) {
+        check(calls[i].result == GX_CALL_CANCEL);
+        check(!network->_calls.find(calls[i].seq));
+    }
+
+    /* every slot is free again, later seqs don't grow the table */
+    for (unsigned seq = count + 1; seq < CallTable::initial_size * 64; ++seq) {
+        check(network->_calls.insert(seq, ctx));
+        network->_calls.remove(seq);
+    }
+    check(network->_calls.capacity() == CallTable::initial_size);
+
+    printf("%s\n", failed ? "FAIL" : "PASS");
+    return failed ? 1 : 0;
+}
@@ -3,42 +3,55 @@
 
 GX_NS_BEGIN
 
+#define __level_shift(level)    (TimerManager::wheel_bits + (level) * TimerManager::level_bits)
+#define __level_index(t, level) (((t) >> __level_shift(level)) & (TimerManager::level_size - 1))
+#define __map_set(map, slot)    ((map)[(slot) / 64] |= (uint64_t)1 << ((slot) & 63))
+#define __map_clear(map, slot)  ((map)[(slot) / 64] &= ~((uint64_t)1 << ((slot) & 63)))
+
+static_assert(TimerManager::wheel_size % 64 == 0 && TimerManager::level_size % 64 == 0,
+    "slot maps are whole words");
+
 TimerManager::TimerManager() noexcept
-: _left(), _cache(_pool)
+: _current(adjust_time()), _next(), _count(), _wheel_map(), _level_map(), _cache(_pool)
 { }
 
 TimerManager::~TimerManager() {
     clear();
 }
 
-inline void TimerManager::schedule_timer(Timer *new_timer) noexcept {
-    node **link = &_root;
-    node *parent = nullptr;
-    int left = 1;
-
-    while (*link) {
-        parent = *link;
-        Timer *timer = static_cast<Timer*>(parent);
-        if (new_timer->_expires < timer->_expires) {
-            link = &(*link)->_left;
-        } else {
-            link = &(*link)->_right;
-            left = 0;
-        }
+inline void TimerManager::schedule_timer(Timer *timer) noexcept {
+    timeval_t expires = timer->_expires;
+    if (expires < _next) {
+        _next = expires;
+    }
+    if (expires < _current) {
+        /* already due, runs before the wheel moves on */
+        _due.push_back(timer);
+        return;
     }
 
-    if (left) {
-        _left = new_timer;
+    timeval_t delta = expires - _current;
+    if (delta < wheel_size) {
+        unsigned slot = expires & (wheel_size - 1);
+        _wheel[slot].push_back(timer);
+        __map_set(_wheel_map, slot);
+        return;
+    }
+    if (delta >= max_delay) {
+        expires = _current + max_delay - 1;
+        delta = max_delay - 1;
+    }
+    unsigned level = 0;
+    while (delta >= ((timeval_t)1 << __level_shift(level + 1))) {
+        level++;
     }
-    rbtree::link(new_timer, parent, link);
-    rbtree::insert(new_timer);
+    unsigned slot = __level_index(expires, level);
+    _levels[level][slot].push_back(timer);
+    __map_set(_level_map[level], slot);
 }
 
 inline void TimerManager::remove_timer(Timer *timer) noexcept {
-    if (_left == timer) {
-        _left = static_cast<Timer*>(timer->next());
-    }
-    rbtree::remove(timer);
+    timer_list_t::remove(timer);
 }
 
 inline void TimerManager::modify_timer(Timer *timer, timeval_t expires) noexcept {
@@ -49,64 +62,171 @@ inline void TimerManager::modify_timer(Timer *timer, timeval_t expires) noexcept
     }
 }
 
+/* places the timers of the slot the wheel has reached one level down */
+void TimerManager::cascade(unsigned level) noexcept {
+    unsigned index = __level_index(_current, level);
+    if (!index && level + 1 < levels) {
+        cascade(level + 1);
+    }
+    timer_list_t list;
+    list.swap(_levels[level][index]);
+    __map_clear(_level_map[level], index);
+    Timer *timer;
+    while ((timer = list.pop_front())) {
+        schedule_timer(timer);
+    }
+}
+
 Timer *TimerManager::schedule_abs(timeval_t expires, Timer::handler_type handler) noexcept {
     Timer *timer = _cache.construct();
     timer->_expires = expires;
     timer->_handler = std::move(handler);
     timer->_mgr = this;
     schedule_timer(timer);
+    _count++;
     return timer;
 }
 
-timeval_t TimerManager::loop(timeval_t curtime) noexcept {
+void TimerManager::run_due(timeval_t curtime) noexcept {
     Timer *timer;
-again:
-    while ((timer = _left)) {
-        if (curtime < timer->_expires) {
-            return timer->_expires;
-        }
-
+    while ((timer = _due.pop_front())) {
         while (1) {
             timer->_mgr = nullptr;
             timeval_t d = timer->_handler(*timer, curtime);
             if (!d) {
-                remove_timer(timer);
                 _cache.destroy(timer);
-                goto again;
+                _count--;
+                break;
             }
             d += timer->_expires;
             if (d > curtime) {
                 timer->_mgr = this;
-                modify_timer(timer, d);
-                goto again;
+                timer->_expires = d;
+                schedule_timer(timer);
+                break;
             }
             timer->_expires = d;
         }
     }
-    return (timeval_t)-1;
+}
+
+/* how far past `from` the first timer of a ring of slots is, -1 if none.
+ * Removed timers leave their bit set, it is cleared when found stale.
+ */
+int TimerManager::first_slot(uint64_t *map, timer_list_t *lists, unsigned size, unsigned from) noexcept {
+    unsigned words = size / 64;
+    unsigned w = from / 64;
+    uint64_t bits = map[w] & (~(uint64_t)0 << (from & 63));
+    /* one more word than the ring, to come back to the bits before `from` */
+    for (unsigned i = 0; i <= words; ) {
+        if (!bits) {
+            w = (w + 1) & (words - 1);
+            bits = map[w];
+            i++;
+            continue;
+        }
+        unsigned slot = w * 64 + __builtin_ctzll(bits);
+        if (!lists[slot].empty()) {
+            return (slot - from) & (size - 1);
+        }
+        __map_clear(map, slot);
+        bits &= bits - 1;
+    }
+    return -1;
+}
+
+/* the earliest time the wheel has something to do, maybe just a cascade */
+timeval_t TimerManager::next() noexcept {
+    if (!_due.empty()) {
+        return _current;
+    }
+    timeval_t t = (timeval_t)-1;
+    int i = first_slot(_wheel_map, _wheel, wheel_size, _current & (wheel_size - 1));
+    if (i >= 0) {
+        t = _current + i;
+    }
+    for (unsigned level = 0; level < levels; ++level) {
+        unsigned shift = __level_shift(level);
+        timeval_t base = _current >> shift;
+        /* the slot of the current block is still to cascade right at its
+         * start, later on it holds the block a whole turn ahead
+         */
+        unsigned first = (_current & (((timeval_t)1 << shift) - 1)) ? 1 : 0;
+        i = first_slot(_level_map[level], _levels[level], level_size, (base + first) & (level_size - 1));
+        if (i >= 0) {
+            timeval_t start = (base + first + i) << shift;
+            if (start < t) {
+                t = start;
+            }
+        }
+    }
+    return t;
+}
+
+timeval_t TimerManager::loop(timeval_t curtime) noexcept {
+    if (curtime < _next) {
+        return _next;
+    }
+    run_due(curtime);
+    while (_current <= curtime) {
+        if (!_count) {
+            _current = curtime + 1;
+            break;
+        }
+        unsigned index = _current & (wheel_size - 1);
+        if (index && _wheel[index].empty()) {
+            /* skip the idle ticks, after a stall there can be many */
+            timeval_t t = next();
+            if (t > curtime) {
+                _current = curtime + 1;
+                break;
+            }
+            _current = t;
+            continue;
+        }
+        if (!index) {
+            cascade(0);
+        }
+        _due.swap(_wheel[index]);
+        __map_clear(_wheel_map, index);
+        _current++;
+        run_due(curtime);
+    }
+    return _next = _count ? next() : (timeval_t)-1;
 }
 
 void TimerManager::modify(Timer *timer, timeval_t expires) noexcept {
-    modify_timer(timer, expires);
+    if (timer->_mgr == this) {
+        modify_timer(timer, expires);
+    }
 }
 
 void TimerManager::remove(Timer *timer) noexcept {
     if (timer->_mgr == this) {
         remove_timer(timer);
         _cache.destroy(timer);
+        _count--;
     }
 }
 
-void TimerManager::clear() noexcept {
-    Timer *timer = _left;
-    Timer *tmp;
-    while (timer) {
-        tmp = static_cast<Timer*>(timer->next());
+inline void TimerManager::clear(timer_list_t &list) noexcept {
+    Timer *timer;
+    while ((timer = list.pop_front())) {
         _cache.destroy(timer);
-        timer = tmp;
+        _count--;
+    }
+}
+
+void TimerManager::clear() noexcept {
+    clear(_due);
+    for (auto &list : _wheel) {
+        clear(list);
+    }
+    for (auto &level : _levels) {
+        for (auto &list : level) {
+            clear(list);
+        }
     }
-    _left = nullptr;
-    rbtree::clear();
 }
 
 GX_NS_END
@@ -1,10 +1,9 @@
 #ifndef __GX_TIMERMANAGER_H__
 #define __GX_TIMERMANAGER_H__
 
-#include <functional>
+#include "function.h"
 #include "memory.h"
 #include "singleton.h"
-#include "rbtree.h"
 #include "timeval.h"
 #include "list.h"
 #include "obstack.h"
@@ -14,51 +13,79 @@ GX_NS_BEGIN
 
 class TimerManager;
 
-class Timer : protected rbtree::node, public WeakableObject {
+class Timer : public WeakableObject {
     friend class TimerManager;
 public:
-    typedef std::function<timeval_t(Timer&, timeval_t)> handler_type;
+    /* big enough for a bound member function and two arguments */
+    typedef inline_function<timeval_t(Timer&, timeval_t)> handler_type;
 
     void close() noexcept;
     timeval_t expire() const noexcept {
         return _expires;
     }
 private:
+    clist_entry _entry;
     timeval_t _expires;
     handler_type _handler;
     TimerManager *_mgr;
 };
 
-class TimerManager : public Object, protected rbtree, public singleton<TimerManager> {
+/* TimerManager
+ * A hierarchical timing wheel at 1 ms resolution: 256 slots for the next
+ * 256 ms, then three levels of 256 slots each 256 times coarser (about 49
+ * days in all, later timers wait in the last slot and get placed again).
+ * Timers move down a level when the wheel reaches their slot, schedule and
+ * remove are O(1). Every move is a cache miss on the timer, so the levels
+ * are wide: timers up to a minute move once, up to 4.6 hours twice.
+ * A bit per slot marks the ones that may hold timers, next() skips the rest,
+ * and loop() does nothing before the time it returned last.
+ */
+class TimerManager : public Object, public singleton<TimerManager> {
+    typedef gx_list(Timer, _entry) timer_list_t;
+public:
+    static constexpr const unsigned wheel_bits = 8;
+    static constexpr const unsigned level_bits = 8;
+    static constexpr const unsigned levels = 3;
+    static constexpr const unsigned wheel_size = 1 << wheel_bits;
+    static constexpr const unsigned level_size = 1 << level_bits;
+    static constexpr const timeval_t max_delay = (timeval_t)1 << (wheel_bits + level_bits * levels);
 public:
     TimerManager() noexcept;
     ~TimerManager();
 
     Timer *schedule_abs(timeval_t expires, Timer::handler_type handler) noexcept;
     Timer *schedule(timeval_t expires, Timer::handler_type handler) noexcept {
-        return schedule_abs(gettimeofday() + expires, Timer::handler_type(handler));
+        return schedule_abs(monotime() + expires, std::move(handler));
     }
     void modify(Timer *timer, timeval_t expires) noexcept;
     void remove(Timer *timer) noexcept;
     timeval_t loop(timeval_t curtime) noexcept;
     timeval_t loop() noexcept {
-        timeval_t cur = adjust_time();
-        while (1) {
-            timeval_t t = loop(cur);
-            cur = adjust_time();
-            if (t > cur) {
-                return t;
-            }
-        }
+        return loop(monotime());
     }
 
     void clear() noexcept;
+    size_t size() const noexcept {
+        return _count;
+    }
 private:
     void schedule_timer(Timer *timer) noexcept;
     void modify_timer(Timer *timer, timeval_t expires) noexcept;
     void remove_timer(Timer *timer) noexcept;
+    void cascade(unsigned level) noexcept;
+    void run_due(timeval_t curtime) noexcept;
+    timeval_t next() noexcept;
+    int first_slot(uint64_t *map, timer_list_t *lists, unsigned size, unsigned from) noexcept;
+    void clear(timer_list_t &list) noexcept;
 private:
-    Timer *_left;
+    timeval_t _current;
+    timeval_t _next;
+    size_t _count;
+    timer_list_t _due;
+    timer_list_t _wheel[wheel_size];
+    timer_list_t _levels[levels][level_size];
+    uint64_t _wheel_map[wheel_size / 64];
+    uint64_t _level_map[levels][level_size / 64];
     object<Obstack> _pool;
     object_cache<Timer, Obstack> _cache;
 };
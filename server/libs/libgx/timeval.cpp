@@ -2,7 +2,10 @@
 
 GX_NS_BEGIN
 
-timeval_t the_now = adjust_time();
+thread_local timeval_t the_wall;
+thread_local timeval_t the_now;
+/* the main thread's, loop threads adjust their own as they start */
+static timeval_t __start_time = adjust_time();
 timeval_t the_logic_offset = 0;
 
 std::string strtime(timeval_t time) noexcept {
@@ -11,23 +11,58 @@ GX_NS_BEGIN
 
 
 typedef uint64_t timeval_t;
-extern timeval_t the_now;
+
+/* Time
+ * monotime() is a monotonic clock in msec, what timers and timeouts run on,
+ * so stepping the system clock doesn't fire or stall them. gettimeofday()
+ * and walltime() are the wall clock for logs and logic_time(). Both are
+ * cached per thread, adjust_time() reads them once per loop iteration (the
+ * coarse clocks are a vDSO read), so every loop runs its timers on its own
+ * clock.
+ */
+extern thread_local timeval_t the_now;
+extern thread_local timeval_t the_wall;
 extern timeval_t the_logic_offset;
 
-inline timeval_t gettimeofday() noexcept {
+inline timeval_t monotime() noexcept {
     return the_now;
 }
 
+inline timeval_t walltime() noexcept {
+    return the_wall;
+}
+
+inline timeval_t gettimeofday() noexcept {
+    return the_wall;
+}
+
 inline timeval_t logic_time() noexcept {
-    return the_now + the_logic_offset;
+    return the_wall + the_logic_offset;
 }
 
+#if defined(CLOCK_MONOTONIC_COARSE) && defined(CLOCK_REALTIME_COARSE)
+inline timeval_t __clock_msec(clockid_t id) noexcept {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (timeval_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+inline timeval_t adjust_time() noexcept {
+    the_wall = __clock_msec(CLOCK_REALTIME_COARSE);
+    the_now = __clock_msec(CLOCK_MONOTONIC_COARSE);
+    return the_now;
+}
+#else
 inline timeval_t adjust_time() noexcept {
-	the_now = std::chrono::duration_cast<std::chrono::milliseconds>(
+    the_wall = std::chrono::duration_cast<std::chrono::milliseconds>(
         std::chrono::system_clock::now().time_since_epoch()
     ).count();
-	return the_now;
+    the_now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+    return the_now;
 }
+#endif
 
 inline timeval_t the_second(timeval_t t = 0) noexcept {
     return (t ? t : logic_time()) / 1000;
@@ -0,0 +1,194 @@
+#include "uring.h"
+
+#ifdef GX_REACTOR_USE_URING
+
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+GX_NS_BEGIN
+
+static inline int __uring_setup(unsigned entries, struct ::io_uring_params *p) noexcept {
+    return (int)::syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int __uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) noexcept {
+    return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+URing::URing() noexcept
+: _fd(-1),
+  _features(),
+  _sq_ring(MAP_FAILED),
+  _sq_ring_size(),
+  _cq_ring(MAP_FAILED),
+  _cq_ring_size(),
+  _sqes((sqe_type*)MAP_FAILED),
+  _sqes_size(),
+  _sq_local_tail(),
+  _sq_submitted()
+{ }
+
+URing::~URing() noexcept {
+    destroy();
+}
+
+void URing::destroy() noexcept {
+    if (_sqes != MAP_FAILED) {
+        munmap(_sqes, _sqes_size);
+        _sqes = (sqe_type*)MAP_FAILED;
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    _cq_ring = MAP_FAILED;
+    if (_sq_ring != MAP_FAILED) {
+        munmap(_sq_ring, _sq_ring_size);
+        _sq_ring = MAP_FAILED;
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool URing::init(unsigned entries) noexcept {
+    struct ::io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    if ((_fd = __uring_setup(entries, &p)) < 0) {
+        _fd = -1;
+        return false;
+    }
+    _features = p.features;
+
+    /* timed waits need EXT_ARG, multishot poll and poll update came with RSRC_TAGS */
+    unsigned required = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+    if ((_features & required) != required) {
+        destroy();
+        return false;
+    }
+
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(cqe_type);
+    if (_features & IORING_FEAT_SINGLE_MMAP) {
+        if (_cq_ring_size > _sq_ring_size) {
+            _sq_ring_size = _cq_ring_size;
+        }
+        _cq_ring_size = _sq_ring_size;
+    }
+
+    _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        destroy();
+        return false;
+    }
+    if (_features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ring = _sq_ring;
+    }
+    else {
+        _cq_ring = mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) {
+            destroy();
+            return false;
+        }
+    }
+    _sqes_size = p.sq_entries * sizeof(sqe_type);
+    _sqes = (sqe_type*)mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        destroy();
+        return false;
+    }
+
+    char *sq = (char*)_sq_ring;
+    _sq_head = (unsigned*)(sq + p.sq_off.head);
+    _sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    _sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    _sq_array = (unsigned*)(sq + p.sq_off.array);
+    _sq_entries = p.sq_entries;
+    _sq_local_tail = _sq_submitted = *_sq_tail;
+
+    char *cq = (char*)_cq_ring;
+    _cq_head = (unsigned*)(cq + p.cq_off.head);
+    _cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    _cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = (cqe_type*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+URing::sqe_type *URing::sqe() noexcept {
+    unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (gx_unlikely(_sq_local_tail - head >= _sq_entries)) {
+        if (submit() < 0) {
+            return nullptr;
+        }
+        head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        if (_sq_local_tail - head >= _sq_entries) {
+            return nullptr;
+        }
+    }
+    unsigned index = _sq_local_tail & *_sq_mask;
+    sqe_type *sqe = _sqes + index;
+    memset(sqe, 0, sizeof(sqe_type));
+    _sq_array[index] = index;
+    _sq_local_tail++;
+    return sqe;
+}
+
+int URing::submit() noexcept {
+    unsigned count = _sq_local_tail - _sq_submitted;
+    if (!count) {
+        return 0;
+    }
+    __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+    while (1) {
+        int n = __uring_enter(_fd, count, 0, 0, nullptr, 0);
+        if (gx_likely(n >= 0)) {
+            _sq_submitted += n;
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return -errno;
+    }
+}
+
+int URing::wait(timeval_t timeout) noexcept {
+    struct ::__kernel_timespec ts;
+    struct ::io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000;
+    arg.ts = (uintptr_t)&ts;
+
+    unsigned count = _sq_local_tail - _sq_submitted;
+    __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+    int n = __uring_enter(_fd, count, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (gx_unlikely(n < 0)) {
+        if (errno == ETIME || errno == EINTR) {
+            return 0;
+        }
+        return -errno;
+    }
+    _sq_submitted += n;
+    return n;
+}
+
+unsigned URing::peek(cqe_type *cqes, unsigned count) noexcept {
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+    while (head != tail && n < count) {
+        cqes[n++] = _cqes[head & *_cq_mask];
+        head++;
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+GX_NS_END
+
+#endif
+
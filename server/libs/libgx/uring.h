@@ -0,0 +1,67 @@
+#ifndef __GX_URING_H__
+#define __GX_URING_H__
+
+#include "platform.h"
+
+#ifdef GX_REACTOR_USE_URING
+
+#include <linux/io_uring.h>
+#include "timeval.h"
+
+GX_NS_BEGIN
+
+/* URing
+ * A minimal io_uring submission/completion ring, driven by raw system calls.
+ */
+class URing {
+public:
+    typedef struct ::io_uring_sqe sqe_type;
+    typedef struct ::io_uring_cqe cqe_type;
+
+public:
+    URing() noexcept;
+    ~URing() noexcept;
+
+    bool init(unsigned entries) noexcept;
+    bool valid() const noexcept {
+        return _fd >= 0;
+    }
+    sqe_type *sqe() noexcept;
+    int submit() noexcept;
+    int wait(timeval_t timeout) noexcept;
+    unsigned peek(cqe_type *cqes, unsigned count) noexcept;
+
+private:
+    void destroy() noexcept;
+
+private:
+    int _fd;
+    unsigned _features;
+
+    void *_sq_ring;
+    size_t _sq_ring_size;
+    void *_cq_ring;
+    size_t _cq_ring_size;
+    sqe_type *_sqes;
+    size_t _sqes_size;
+
+    unsigned *_sq_head;
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned _sq_entries;
+    unsigned _sq_local_tail;
+    unsigned _sq_submitted;
+
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    cqe_type *_cqes;
+};
+
+GX_NS_END
+
+#endif
+
+#endif
+